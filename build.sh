@@ -5,7 +5,7 @@ set -xe
 CC="${CXX:-cc}"
 PKGS="sdl2 glew freetype2"
 CFLAGS="-Wall -Wextra -std=c11 -pedantic -ggdb"
-LIBS=-lm
+LIBS="-lm -pthread"
 SRC=$(find src -name "*.c")
 INCLUDE=-Iinclude
 
@@ -11,41 +11,160 @@
 
 #include "ds/dynamic_array.h"
 #include "ds/string_builder.h"
+#include "ds/piece_table.h"
+#include "ds/gap_buffer.h"
+#include "ds/rope.h"
+#include "ds/line_index.h"
+#include "ds/char_index.h"
+#include "ds/bracket_index.h"
+#include "ds/journal.h"
+#include "ds/range.h"
 #include "be/common.h"
 #include "simple_renderer.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+typedef enum {
+    BE_STORAGE_PIECE_TABLE,
+    BE_STORAGE_GAP_BUFFER,
+    BE_STORAGE_ROPE,
+    COUNT_BE_STORAGES,
+} Be_Storage;
+
+// Row of the last position a cursor motion landed on. Motions keep it up to
+// date, so steady-state movement never has to search for the cursor row.
+typedef struct {
+    bool valid;
+    size_t version;
+    size_t row;
+    Line line;
+    Li_Hint hint;
+} Be_Row_Cache;
+
+typedef struct Be_Indexer Be_Indexer;
+
+// Changes made inside a transaction. The line and character indexes only
+// catch up with them at the commit, by rescanning the changed text once.
 typedef struct {
-    size_t home;
-    size_t end;
-} Line;
+    size_t depth; // of nested be_begin
+    bool dirty;
+    size_t from;  // the changed text, in current offsets
+    size_t to;
+    size_t delta; // by how much it grew, wraps around when it shrank
+} Be_Transaction;
 
-da_Type(Lines, Line);
+// Text changed since the last be_take_changes, for what is derived from it
+// outside of the editor. After a reset all of the text is new.
+typedef struct {
+    bool dirty;
+    bool reset;
+    size_t from;  // the changed text, in current offsets
+    size_t to;
+    size_t delta; // by how much it grew, wraps around when it shrank
+} Be_Changes;
 
 typedef struct {
-    String_Builder data;
-    Lines lines;
+    Be_Storage storage; // only the matching text field is in use
+    Piece_Table pt;
+    File_Stamp mapped_file; // file behind pt.original when it is mapped or paged
+    Gap_Buffer gb;
+    Rope rope;
+    Line_Index lines; // unused by the rope, which keeps its own line metrics, and by paged files
+    Char_Index chars; // unused by paged files
+    Char_Index blanks; // blank lines, the paragraph boundaries, unused by paged files
+    Char_Index page_lines; // newlines of every page of a paged file
+    Bracket_Index brackets; // lexed on the first query, unused by paged files
+    size_t utf8_error; // offset of the first byte of the loaded file that is not UTF-8, SIZE_MAX if none
+    size_t version;   // bumped on every change of the text
+    Be_Indexer *indexer; // background indexing of a mapped file, NULL when done
+    Be_Row_Cache row_cache;
+    Journal journal;
+    Be_Transaction txn;
+    Be_Changes changes;
 
     bool selection;
     size_t cur;
 } Basic_Editor;
 
 void be_load_from_file(Basic_Editor *be, const char *filename);
+// Opens the file as a read-only mapping edited through the piece table.
+// Returns false, leaving the editor untouched, if it cannot be mapped.
+bool be_map_file(Basic_Editor *be, const char *filename);
+// To be called regularly: stops reading the mapping once the mapped file is
+// modified in place, reloading it if there are no edits to keep
+void be_check_mapped_file(Basic_Editor *be, const char *filename);
+// For files larger than memory: opens the file as pages read on demand,
+// edited through the piece table. Only a count of newlines is kept for
+// every page, so rows are found by scanning a single page, and columns by
+// scanning the line. Returns false, leaving the editor untouched, if it
+// cannot be opened.
+bool be_page_file(Basic_Editor *be, const char *filename);
+bool be_paged(const Basic_Editor *be);
+void be_set_page_budget(Basic_Editor *be, size_t bytes); // 0 for the default
+
+// A mapped file is indexed in the background. Until that is done, rows are
+// only known up to the indexed frontier, and the cursor and edits are kept
+// before it.
+bool be_indexing(const Basic_Editor *be);
+size_t be_indexed_size(const Basic_Editor *be); // be_size once indexing is done
+float be_index_progress(const Basic_Editor *be);
+void be_index_poll(Basic_Editor *be); // moves new results into the line index
+void be_index_wait(Basic_Editor *be); // finishes indexing in the foreground
+void be_set_storage(Basic_Editor *be, Be_Storage storage);
+// Edits only show up here once their transaction is committed
+Be_Changes be_take_changes(Basic_Editor *be);
+void be_clear(Basic_Editor *be);
 void be_destroy(Basic_Editor *be);
 
+// Text access
+size_t be_size(const Basic_Editor *be);
+char be_char_at(const Basic_Editor *be, size_t at);
+// Returns the longest contiguous run of text starting at `at` and stores its length in `n`.
+// In a paged file it ends with the page, and is only valid until a few other pages are read.
+const char *be_span(const Basic_Editor *be, size_t at, size_t *n);
+void be_copy_n(const Basic_Editor *be, char *dst, size_t from, size_t n);
+// Start of the UTF-8 character before or after the one at `at`. Invalid
+// bytes count as characters of their own, except stray continuation bytes,
+// which stay with the character before them.
+size_t be_prev_char(const Basic_Editor *be, size_t at);
+size_t be_next_char(const Basic_Editor *be, size_t at);
+
+size_t be_line_count(const Basic_Editor *be);
+Line be_line(const Basic_Editor *be, size_t row);
 size_t be_cursor_row(const Basic_Editor *be, size_t cur);
 Line be_get_line(const Basic_Editor *be, size_t cur);
-// TODO: move n
+// Columns count characters, not bytes
+size_t be_col_of(const Basic_Editor *be, Line line, size_t cur);
+// The cursor at a column of the line, or at its end when the line is shorter
+size_t be_cursor_at_col(const Basic_Editor *be, Line line, size_t col);
+size_t be_move_left(Basic_Editor *be, size_t cur);
+size_t be_move_right(Basic_Editor *be, size_t cur);
 size_t be_move_up(Basic_Editor *be, size_t cur);
 size_t be_move_down(Basic_Editor *be, size_t cur);
+// Moves n rows at once, stopping at the first or last one. The column is
+// kept, or the cursor goes to the end of a shorter line.
+size_t be_move_up_n(Basic_Editor *be, size_t cur, size_t n);
+size_t be_move_down_n(Basic_Editor *be, size_t cur, size_t n);
+// Home of the row, or of the last one when there are fewer rows
+size_t be_move_to_row(Basic_Editor *be, size_t row);
 size_t be_move_home(Basic_Editor *be, size_t cur);
 size_t be_move_end(Basic_Editor *be, size_t cur);
 size_t be_move_leftw(Basic_Editor *be, size_t cur);
 size_t be_move_rightw(Basic_Editor *be, size_t cur);
+// Paragraphs are separated by empty lines. Moves to the next or previous
+// empty line, or to the end or the start of the text when there is none.
 size_t be_move_next_paragraph(Basic_Editor *be, size_t cur);
 size_t be_move_prev_paragraph(Basic_Editor *be, size_t cur);
+// Blocks are delimited by brackets, as the lexer finds them, so that those in
+// strings and comments are left out. A block is found from its opening
+// bracket to past its closing one, and false is returned when there is none,
+// as always in a paged file.
+// The innermost block around the bytes between `from` and `to`
+bool be_outer_block(Basic_Editor *be, size_t from, size_t to, Range *block);
+// The first block opening from `at` on
+bool be_next_block(Basic_Editor *be, size_t at, Range *block);
 
 // Manipulation
 #define be_insert_s(be, s) be_insert_sn(be, s, strlen(s))
@@ -57,6 +176,23 @@ size_t be_insert_sn_at(Basic_Editor *be, const char *s, size_t n, size_t at);
 void be_delete_n_from(Basic_Editor *be, size_t n, size_t from);
 size_t be_insert_line_above(Basic_Editor *be, size_t cur);
 size_t be_insert_line_below(Basic_Editor *be, size_t cur);
+// Edits between these are a single undo step, and update the line and
+// character indexes once at the commit. Rows, lines and columns cannot be
+// looked up in between.
+void be_begin(Basic_Editor *be);
+void be_commit(Basic_Editor *be);
+// Replaces each of the sorted, disjoint ranges by s as one edit, walking
+// the text once from left to right. On return the ranges hold where each
+// copy of s ended up.
+void be_replace_ranges(Basic_Editor *be, Range *ranges, size_t count, const char *s, size_t n);
+
+// Undo: consecutive keystrokes make up a single step, which ends at a line
+// break or at be_undo_seal. Undoing and redoing move the cursor to the change
+// and return false when there is nothing to do.
+bool be_undo(Basic_Editor *be);
+bool be_redo(Basic_Editor *be);
+void be_undo_seal(Basic_Editor *be);
+void be_set_undo_limit(Basic_Editor *be, size_t bytes); // 0 for the default
 
 
 #endif // EDITOR_H_
@@ -1,11 +1,31 @@
 #ifndef MEDO_COMMON_H_
 #define MEDO_COMMON_H_
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #define SWAP(T, a, b) do { T t = a; a = b; b = t; } while (0)
 
-char *read_entire_file(const char *filename);
+char *read_entire_file(const char *filename, size_t *size);
+
+// Identity and version of a file on disk
+typedef struct {
+    unsigned long long dev;
+    unsigned long long ino;
+    long long size;
+    long long mtime_sec;
+    long long mtime_nsec;
+} File_Stamp;
+
+bool file_stamp(const char *filename, File_Stamp *stamp);
+bool file_stamp_same_file(File_Stamp a, File_Stamp b);
+bool file_stamp_eq(File_Stamp a, File_Stamp b);
+
+// Maps the file read-only without copying it. Returns NULL when it cannot
+// be mapped (empty files, pipes, ...), in which case it should be read.
+char *map_entire_file(const char *filename, size_t *size, File_Stamp *stamp);
+// Opens the file for reading, or returns -1 under the same conditions
+int open_entire_file(const char *filename, size_t *size, File_Stamp *stamp);
 
 #endif // MEDO_COMMON_H_
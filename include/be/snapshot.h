@@ -0,0 +1,41 @@
+#ifndef MEDO_SNAPSHOT_H_
+#define MEDO_SNAPSHOT_H_
+
+#include "be/basic_editor.h"
+
+#include <stdatomic.h>
+
+// An immutable version of the text of an editor and of its rows, for workers
+// that lex, search or save while the user keeps typing. Later edits never
+// touch it, so it is read with no lock, and it is freed with its last
+// reference. A snapshot of a paged file reads through a page cache of its
+// own, and is read from one thread at a time.
+//
+// Taking one costs O(1) for a rope, whose nodes are shared, and O(pieces)
+// for a piece table, whose buffers are. A gap buffer is copied. The rows of
+// both are summed up per block of the line index, and found by scanning a
+// block of the snapshot.
+typedef struct {
+    atomic_size_t refs;
+    size_t version;     // of the editor when it was taken
+    Be_Storage storage; // the rope or the piece table, which holds a copied gap buffer
+    Piece_Table pt;
+    Rope rope;
+    Char_Index lines;   // newlines of every block, unused by the rope
+    size_t indexed;     // rows are only known up to here, see be_indexed_size
+} Be_Snapshot;
+
+// Not inside a transaction, where the rows are out of date
+Be_Snapshot *be_snapshot(const Basic_Editor *be);
+Be_Snapshot *snap_retain(Be_Snapshot *snap);
+void snap_release(Be_Snapshot *snap);
+
+size_t snap_size(const Be_Snapshot *snap);
+const char *snap_span(const Be_Snapshot *snap, size_t at, size_t *n);
+void snap_copy_n(const Be_Snapshot *snap, char *dst, size_t from, size_t n);
+
+size_t snap_line_count(const Be_Snapshot *snap);
+Line snap_line(const Be_Snapshot *snap, size_t row);
+size_t snap_row_of(const Be_Snapshot *snap, size_t at);
+
+#endif // MEDO_SNAPSHOT_H_
@@ -0,0 +1,72 @@
+#ifndef MEDO_DS_BRACKET_INDEX_H_
+#define MEDO_DS_BRACKET_INDEX_H_
+
+#include "ds/dynamic_array.h"
+#include "ds/fenwick.h"
+#include "ds/char_index.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef BI_BLOCK_MAX
+#  define BI_BLOCK_MAX 4096
+#endif // BI_BLOCK_MAX
+
+#define BI_DIRTY SIZE_MAX
+
+// Brackets of a piece of text. Joining two pieces matches the unmatched
+// opening brackets of the first with the unmatched closing ones of the
+// second.
+typedef struct {
+    size_t bytes;
+    size_t lead;    // before the first token starting in the piece, all of them if none does, BI_DIRTY until lexed
+    size_t close;   // unmatched closing brackets
+    size_t open;    // unmatched opening brackets
+    size_t openers; // all of the opening brackets
+} Bi_Block;
+
+da_Type(Bi_Blocks, Bi_Block);
+
+// Brackets of the text as the lexer finds them, leaving out those in strings
+// and comments. Brackets of all kinds match each other. The text is cut into
+// blocks of BI_BLOCK_MAX bytes, which edits let grow to twice that, and their
+// brackets are joined in a segment tree, so that finding the bracket matching
+// another walks down the tree and lexes a block or two.
+//
+// An edit only marks the blocks it touched. The next bi_sync lexes them again
+// from the last token starting before them, and stops at the first block past
+// them whose first token starts where it did.
+typedef struct {
+    Bi_Blocks blocks;
+    Fenwick bytes;
+    Bi_Blocks tree;       // root at 1, the blocks from `leaves` on
+    size_t leaves;
+    size_t size;
+    size_t dirty;         // blocks to lex again
+} Bracket_Index;
+
+void bi_clear(Bracket_Index *bi);
+void bi_end(Bracket_Index *bi);
+
+size_t bi_size(const Bracket_Index *bi);
+
+// Lexes the blocks changed since the last call, and the text from bi_size
+// up to `size` when that is more. Only the text up to bi_size is indexed.
+void bi_sync(Bracket_Index *bi, const void *text, Ci_Span span, size_t size);
+
+// Queries, on a synced index. A pair of brackets is returned as the offsets
+// of its opening and closing brackets, and false when there is none, with
+// the bracket that was not found at SIZE_MAX. The text past bi_size may hold
+// the closing bracket, or the opening one of bi_next_pair.
+// The innermost pair around the bytes between `from` and `to`
+bool bi_enclosing(const Bracket_Index *bi, const void *text, Ci_Span span, size_t from, size_t to, size_t *open, size_t *close);
+// The first opening bracket from `at` on, and the one closing it
+bool bi_next_pair(const Bracket_Index *bi, const void *text, Ci_Span span, size_t at, size_t *open, size_t *close);
+
+// Updating: `removed` bytes at `from` were replaced by `inserted` bytes. The
+// text is only read at the next bi_sync. An edit reaching past bi_size
+// leaves the text indexed up to `from`.
+void bi_update(Bracket_Index *bi, size_t from, size_t removed, size_t inserted);
+
+#endif // MEDO_DS_BRACKET_INDEX_H_
@@ -0,0 +1,73 @@
+#ifndef MEDO_DS_CHAR_INDEX_H_
+#define MEDO_DS_CHAR_INDEX_H_
+
+#include "ds/dynamic_array.h"
+#include "ds/fenwick.h"
+
+#include <stddef.h>
+
+#ifndef CI_BLOCK_MAX
+#  define CI_BLOCK_MAX 4096
+#endif // CI_BLOCK_MAX
+
+// A character is a byte that is not a UTF-8 continuation byte, together with
+// the continuation bytes after it. A blank line is counted by the newline
+// that ends an empty line, which is a newline right after another one or at
+// the start of the text.
+typedef enum {
+    CI_CHARS = 0,
+    CI_NEWLINES,
+    CI_BLANK_LINES,
+    COUNT_CI_UNITS,
+} Ci_Unit;
+
+typedef struct {
+    size_t bytes;
+    size_t chars; // or newlines or blank lines, see Ci_Unit
+} Ci_Block;
+
+da_Type(Ci_Blocks, Ci_Block);
+
+// Reads the text through the spans it is made of, see be_span
+typedef const char *(*Ci_Span)(const void *text, size_t at, size_t *n);
+
+// Sparse map between characters and byte offsets: the text is cut into
+// blocks of at most CI_BLOCK_MAX bytes whose sizes and character counts are
+// kept in Fenwick trees. A lookup walks the trees and then scans no more
+// than one block, and none at all in a block without multibyte characters.
+// Counting newlines instead makes it a coarse line index, which only knows
+// how many lines each block has, and counting blank lines an index of the
+// paragraph boundaries. A blank line depends on the byte before it, so the
+// blank lines of a block include one ended by its first byte.
+typedef struct {
+    Ci_Blocks blocks;
+    Fenwick bytes;
+    Fenwick chars;
+    size_t size;
+    Ci_Unit unit;     // set before the first use,
+    size_t block_max; // as well as this, CI_BLOCK_MAX when 0
+} Char_Index;
+
+void ci_clear(Char_Index *ci);
+void ci_end(Char_Index *ci);
+
+// Indexes the next n bytes of the text after the ones already indexed
+void ci_append(Char_Index *ci, const void *text, Ci_Span span, size_t n);
+void ci_append_blocks(Char_Index *ci, const Ci_Block *blocks, size_t n);
+// Cuts the n bytes at s into blocks of the unit for ci_append_blocks. There
+// must be room for n / CI_BLOCK_MAX + 1 of them; returns how many were made.
+// `prev` is the byte before s, a newline at the start of the text.
+size_t ci_make_blocks(Ci_Block *blocks, Ci_Unit unit, const char *s, size_t n, char prev);
+
+size_t ci_size(const Char_Index *ci);
+size_t ci_total(const Char_Index *ci); // characters in the text
+// Number of characters starting before `at`
+size_t ci_char_of(const Char_Index *ci, const void *text, Ci_Span span, size_t at);
+// Offset of character number `ch`, the size of the text when there is none
+size_t ci_offset_of(const Char_Index *ci, const void *text, Ci_Span span, size_t ch);
+
+// Updating: `removed` bytes at `from` were replaced by `inserted` bytes,
+// which are already in the text
+void ci_update(Char_Index *ci, const void *text, Ci_Span span, size_t from, size_t removed, size_t inserted);
+
+#endif // MEDO_DS_CHAR_INDEX_H_
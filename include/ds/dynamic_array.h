@@ -72,28 +72,28 @@
 
 #define da_insert_n(da, d, n, at) \
     do { \
-        assert((da) != NULL && d != NULL); \
-        assert(at <= (da)->size); \
+        assert((da) != NULL && (d) != NULL); \
+        assert((at) <= (da)->size); \
  \
         if ((da)->capacity == 0) { \
             (da)->capacity = DA_INIT_CAPACITY; \
             (da)->data = calloc(DA_INIT_CAPACITY, TYPESIZE(da)); \
         } \
  \
-        while ((da)->capacity < (da)->size + n) { \
+        while ((da)->capacity < (da)->size + (n)) { \
             (da)->capacity *= 2; \
             (da)->data = realloc((da)->data, (da)->capacity * TYPESIZE(da)); \
             assert((da)->data != NULL); \
         } \
  \
         memmove( \
-            (da)->data + (at + n), \
-            (da)->data + at, \
-            ((da)->size - at) * TYPESIZE(da) \
+            (da)->data + ((at) + (n)), \
+            (da)->data + (at), \
+            ((da)->size - (at)) * TYPESIZE(da) \
         ); \
-        memcpy((da)->data + at, d, (n * TYPESIZE(da))); \
+        memcpy((da)->data + (at), (d), ((n) * TYPESIZE(da))); \
  \
-        (da)->size += n; \
+        (da)->size += (n); \
     } while (0)
 
 #define da_insert(da, d, at) da_insert_n(da, d, 1, at)
@@ -103,21 +103,21 @@
 
 #define da_remove_n_from(da, n, from) \
     do { \
-        assert(from + n <= (da)->size);  \
+        assert((from) + (n) <= (da)->size);  \
  \
-        if (from + n == (da)->size) { \
-            memset((da)->data + from, 0, n * TYPESIZE(da)); \
+        if ((from) + (n) == (da)->size) { \
+            memset((da)->data + (from), 0, (n) * TYPESIZE(da)); \
         } else { \
             memmove( \
-                (da)->data + from,  \
-                (da)->data + (from + n),  \
-                ((da)->size - from - n) * TYPESIZE(da) \
+                (da)->data + (from),  \
+                (da)->data + ((from) + (n)),  \
+                ((da)->size - (from) - (n)) * TYPESIZE(da) \
             ); \
         } \
-        (da)->size -= n; \
+        (da)->size -= (n); \
  \
         if ((da)->size < (da)->capacity / 2 && (da)->capacity / 2 > DA_INIT_CAPACITY) { \
-            (da)->data = realloc((da)->data, (da)->capacity / 2); \
+            (da)->data = realloc((da)->data, (da)->capacity / 2 * TYPESIZE(da)); \
             assert((da)->data != NULL); \
             (da)->capacity /= 2; \
         } \
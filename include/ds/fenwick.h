@@ -0,0 +1,21 @@
+#ifndef MEDO_DS_FENWICK_H_
+#define MEDO_DS_FENWICK_H_
+
+#include "ds/dynamic_array.h"
+
+#include <stddef.h>
+
+// Fenwick tree of sums over an array of values. Index 0 of the tree array
+// is unused. Updates are done with wrapping unsigned deltas, which keeps
+// every stored sum exact.
+da_Type(Fenwick, size_t);
+
+// Sum of the first n values
+size_t fenwick_prefix(const Fenwick *t, size_t n);
+void fenwick_add(Fenwick *t, size_t i, size_t delta);
+// Largest n such that the sum of the first n values is <= x
+size_t fenwick_search(const Fenwick *t, size_t x, size_t *sum);
+// Appends a value at the end
+void fenwick_push(Fenwick *t, size_t value);
+
+#endif // MEDO_DS_FENWICK_H_
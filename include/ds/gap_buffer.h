@@ -0,0 +1,32 @@
+#ifndef MEDO_DS_GAP_BUFFER_H_
+#define MEDO_DS_GAP_BUFFER_H_
+
+#include <stddef.h>
+
+#ifndef GB_MIN_GAP
+#  define GB_MIN_GAP 4096
+#endif // GB_MIN_GAP
+
+// The text lives in data[0, gap_home) and data[gap_end, capacity). The gap
+// is only moved when an edit happens somewhere else, so a burst of typing
+// at one spot is a plain write into the gap.
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t gap_home;
+    size_t gap_end;
+} Gap_Buffer;
+
+#define gb_size(gb) ((gb)->capacity - ((gb)->gap_end - (gb)->gap_home))
+
+void gb_init(Gap_Buffer *gb, char *data, size_t size); // takes ownership of data
+void gb_clear(Gap_Buffer *gb);
+void gb_end(Gap_Buffer *gb);
+
+char gb_char_at(const Gap_Buffer *gb, size_t at);
+const char *gb_span(const Gap_Buffer *gb, size_t at, size_t *n);
+
+void gb_insert(Gap_Buffer *gb, const char *s, size_t n, size_t at);
+void gb_delete(Gap_Buffer *gb, size_t n, size_t from);
+
+#endif // MEDO_DS_GAP_BUFFER_H_
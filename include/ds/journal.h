@@ -0,0 +1,69 @@
+#ifndef MEDO_DS_JOURNAL_H_
+#define MEDO_DS_JOURNAL_H_
+
+#include "ds/dynamic_array.h"
+#include "ds/string_builder.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef JN_LIMIT
+#  define JN_LIMIT (64 * 1024 * 1024)
+#endif // JN_LIMIT
+
+// Keystrokes keep extending the same delta until it reaches this size
+#ifndef JN_RUN_MAX
+#  define JN_RUN_MAX 256
+#endif // JN_RUN_MAX
+
+// The text at `at` that was `removed` and replaced by `inserted` bytes. Both
+// are kept in the journal bytes starting at `data`, removed text first.
+typedef struct {
+    size_t at;
+    size_t removed;
+    size_t inserted;
+    size_t data;
+    bool joined; // undone and redone together with the previous delta
+} Jn_Delta;
+
+da_Type(Jn_Deltas, Jn_Delta);
+
+// Undo history as a list of deltas, so that a step costs memory and time in
+// proportion to the text it changed. Deltas in [first, done) can be undone
+// and the ones from done on redone. When over the limit, the oldest steps
+// are dropped; the space they held is reclaimed once it is half the arrays.
+typedef struct {
+    Jn_Deltas deltas;
+    String_Builder bytes;
+    size_t first;
+    size_t done;
+    size_t limit;      // in bytes, JN_LIMIT when 0
+    size_t group;      // nesting of jn_begin
+    bool sealed;       // the next delta starts a new step
+} Journal;
+
+void jn_clear(Journal *jn);
+void jn_end(Journal *jn);
+void jn_set_limit(Journal *jn, size_t limit);
+size_t jn_memory(const Journal *jn);
+
+// Recording: each edit either extends the last delta or adds a new one
+void jn_insert(Journal *jn, const char *s, size_t n, size_t at);
+// Returns where the caller copies the n bytes about to be deleted, or NULL
+// if the deletion is too big to be recorded, which forgets the history
+char *jn_delete(Journal *jn, size_t n, size_t from);
+void jn_seal(Journal *jn);
+// Everything recorded until the matching jn_commit is a single step
+void jn_begin(Journal *jn);
+void jn_commit(Journal *jn);
+
+// Step over the previous or next step and return the number of its deltas,
+// which are deltas.data[done, done + n) after jn_undo and
+// deltas.data[done - n, done) after jn_redo
+size_t jn_undo(Journal *jn);
+size_t jn_redo(Journal *jn);
+
+#define jn_removed(jn, delta) ((jn)->bytes.data + (delta)->data)
+#define jn_inserted(jn, delta) ((jn)->bytes.data + (delta)->data + (delta)->removed)
+
+#endif // MEDO_DS_JOURNAL_H_
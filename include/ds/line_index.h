@@ -0,0 +1,84 @@
+#ifndef MEDO_DS_LINE_INDEX_H_
+#define MEDO_DS_LINE_INDEX_H_
+
+#include "ds/dynamic_array.h"
+#include "ds/fenwick.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef LI_BLOCK_MAX
+#  define LI_BLOCK_MAX 1024
+#endif // LI_BLOCK_MAX
+
+// Homes are kept in 32 bits, relative to the start of their block. Blocks
+// are cut short where a home would not fit.
+typedef uint32_t Li_Home;
+#ifndef LI_HOME_MAX
+#  define LI_HOME_MAX UINT32_MAX
+#endif // LI_HOME_MAX
+
+typedef struct {
+    size_t home;
+    size_t end;
+} Line;
+
+da_Type(Li_Homes, Li_Home);
+
+// Lines are grouped into blocks and stored relative to the start of their
+// block. Block sizes are kept in Fenwick trees, so an edit only rewrites
+// the lines of the block it touches and shifts every later line lazily
+// through a single O(log blocks) tree update. Only the home of a line is
+// stored, as its end is the newline before the next home.
+typedef struct {
+    Li_Homes homes;
+    size_t bytes; // from the home of the first line to the home of the next block
+} Line_Block;
+
+da_Type(Line_Blocks, Line_Block);
+
+typedef struct {
+    Line_Blocks blocks;
+    Fenwick bytes;
+    Fenwick rows;
+    size_t row_count;
+    size_t version;    // bumped on every change, see Li_Hint
+    size_t home;       // home of the line being appended by li_append
+    size_t block_home; // home of the block being filled by li_append
+} Line_Index;
+
+// Remembers the block of the last lookup so that nearby rows are found
+// without walking the trees. Goes stale by itself when the index changes.
+typedef struct {
+    size_t version;
+    size_t block;
+    size_t first; // first row of the block
+    size_t start; // offset of the block
+} Li_Hint;
+
+void li_clear(Line_Index *li);
+void li_end(Line_Index *li);
+
+// Building: append the offset of every newline in order, then finish with the text size
+void li_append(Line_Index *li, size_t newline);
+void li_append_n(Line_Index *li, const size_t *newlines, size_t n);
+void li_finish(Line_Index *li, size_t size);
+// Same as appending the sorted `newlines` and finishing, with the blocks filled in parallel
+void li_build(Line_Index *li, const size_t *newlines, size_t n, size_t size);
+// Grows the text at its end by whole blocks of lines, which the index takes
+// over. The current last line is joined with the first line of the blocks,
+// and unless they are the `last` ones an empty line is started after them.
+void li_append_blocks(Line_Index *li, Line_Block *blocks, size_t n, bool last);
+
+size_t li_row_count(const Line_Index *li);
+size_t li_row_of(const Line_Index *li, size_t at);
+Line li_line(const Line_Index *li, size_t row);
+size_t li_row_of_hint(const Line_Index *li, size_t at, Li_Hint *hint);
+Line li_line_hint(const Line_Index *li, size_t row, Li_Hint *hint);
+
+// Updating: mirror an edit of the text
+void li_insert(Line_Index *li, const char *s, size_t n, size_t at);
+void li_delete(Line_Index *li, size_t n, size_t from);
+
+#endif // MEDO_DS_LINE_INDEX_H_
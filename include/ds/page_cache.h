@@ -0,0 +1,55 @@
+#ifndef MEDO_DS_PAGE_CACHE_H_
+#define MEDO_DS_PAGE_CACHE_H_
+
+#include "ds/dynamic_array.h"
+
+#include <stddef.h>
+
+#ifndef PC_PAGE_SIZE
+#  define PC_PAGE_SIZE (256 * 1024)
+#endif // PC_PAGE_SIZE
+
+// Memory for pages when neither pc_set_budget nor MEDO_PAGE_BUDGET (in MiB) say otherwise
+#ifndef PC_BUDGET
+#  define PC_BUDGET (256 * 1024 * 1024)
+#endif // PC_BUDGET
+
+// Spans stay valid while fewer pages than this are read after them
+#define PC_MIN_SLOTS 4
+
+typedef struct {
+    size_t page;
+    size_t used; // tick of the last use
+    char *data;
+} Pc_Slot;
+
+da_Type(Pc_Slots, Pc_Slot);
+da_Type(Pc_Map, size_t);
+
+// Reads a file that may be larger than memory a page at a time. Pages are
+// read on demand into slots, and once the budget is used up the least
+// recently used slot is read over. Not thread safe, except for pc_read.
+typedef struct {
+    int fd;
+    size_t size;
+    size_t budget;  // in bytes
+    Pc_Slots slots;
+    Pc_Map slot_of; // of every page, plus one, 0 when it is not in memory
+    size_t tick;
+    size_t reads;   // pages read into slots so far
+} Page_Cache;
+
+void pc_init(Page_Cache *pc, int fd, size_t size); // takes ownership of fd
+void pc_end(Page_Cache *pc);
+void pc_set_budget(Page_Cache *pc, size_t bytes); // 0 for the default
+
+size_t pc_page_count(const Page_Cache *pc);
+// Reads up to n bytes at `at` straight from the file, past the slots.
+// Returns how many there were before the end of the file.
+size_t pc_read(const Page_Cache *pc, size_t at, char *buf, size_t n);
+
+char pc_char_at(Page_Cache *pc, size_t at);
+// The rest of the page holding `at`
+const char *pc_span(Page_Cache *pc, size_t at, size_t *n);
+
+#endif // MEDO_DS_PAGE_CACHE_H_
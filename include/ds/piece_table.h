@@ -0,0 +1,73 @@
+#ifndef MEDO_DS_PIECE_TABLE_H_
+#define MEDO_DS_PIECE_TABLE_H_
+
+#include "ds/dynamic_array.h"
+#include "ds/page_cache.h"
+#include "ds/range.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A run of bytes taken either from the original buffer or from the add buffer
+typedef struct {
+    bool add;
+    size_t start;
+    size_t len;
+} Piece;
+
+da_Type(Pieces, Piece);
+
+// Text that pieces are taken from. It is shared by a piece table and its
+// copies made with pt_share, and freed by whichever lets go of it last.
+typedef struct {
+    atomic_size_t refs;
+    char *data;
+    size_t size;
+    size_t capacity;   // of the add buffer
+    bool mapped;       // data is a read-only file mapping rather than heap memory
+    Page_Cache *paged; // when not NULL, the text is read through it instead
+} Pt_Buffer;
+
+// The original buffer is never modified and the add buffer is only ever
+// appended to, so an edit only touches the pieces array. The add buffer is
+// moved rather than grown in place while it is shared, so the text of a
+// copy never changes.
+typedef struct {
+    Pt_Buffer *original; // NULL when there is none
+    Pt_Buffer *add;      // NULL until the first insertion
+    Pieces pieces;
+    size_t size;
+} Piece_Table;
+
+void pt_init(Piece_Table *pt, char *original, size_t size); // takes ownership of original
+void pt_init_mapped(Piece_Table *pt, char *original, size_t size); // unmaps it when done
+// The original is the file behind the cache, and the edits stay in the add
+// buffer until it is saved. Spans end at the end of the page they are in.
+void pt_init_paged(Piece_Table *pt, Page_Cache *pc); // takes ownership of pc
+// Replaces a mapped original by a heap copy of its first `readable` bytes,
+// zero-filling the rest
+void pt_detach(Piece_Table *pt, size_t readable);
+void pt_clear(Piece_Table *pt);
+void pt_end(Piece_Table *pt);
+// Makes `copy` a read-only piece table with the same text in O(pieces),
+// sharing the buffers, which later edits of `pt` leave alone. The copy of a
+// paged table reads the file through a cache of its own, so it may be read
+// from another thread, but only from one at a time.
+void pt_share(const Piece_Table *pt, Piece_Table *copy);
+
+size_t pt_original_size(const Piece_Table *pt);
+size_t pt_added(const Piece_Table *pt); // bytes ever inserted
+bool pt_mapped(const Piece_Table *pt);
+Page_Cache *pt_paged(const Piece_Table *pt);
+
+char pt_char_at(const Piece_Table *pt, size_t at);
+const char *pt_span(const Piece_Table *pt, size_t at, size_t *n);
+
+void pt_insert(Piece_Table *pt, const char *s, size_t n, size_t at);
+void pt_delete(Piece_Table *pt, size_t n, size_t from);
+// Replaces each of the sorted, disjoint ranges by s in a single pass over the
+// pieces. The inserted pieces all share one copy of s in the add buffer.
+void pt_replace(Piece_Table *pt, const Range *ranges, size_t count, const char *s, size_t n);
+
+#endif // MEDO_DS_PIECE_TABLE_H_
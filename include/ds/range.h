@@ -0,0 +1,16 @@
+#ifndef MEDO_DS_RANGE_H_
+#define MEDO_DS_RANGE_H_
+
+#include "ds/dynamic_array.h"
+
+#include <stddef.h>
+
+// The n bytes of text starting at `from`
+typedef struct {
+    size_t from;
+    size_t n;
+} Range;
+
+da_Type(Ranges, Range);
+
+#endif // MEDO_DS_RANGE_H_
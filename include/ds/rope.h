@@ -0,0 +1,57 @@
+#ifndef MEDO_DS_ROPE_H_
+#define MEDO_DS_ROPE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef ROPE_LEAF_MAX
+#  define ROPE_LEAF_MAX 4096
+#endif // ROPE_LEAF_MAX
+
+#ifndef ROPE_BRANCH_MAX
+#  define ROPE_BRANCH_MAX 16
+#endif // ROPE_BRANCH_MAX
+
+// B-tree of text leaves where every node caches the number of bytes and
+// newlines below it, so that offsets and rows can both be found in O(log n).
+// All the leaves are at the same depth. Nodes are shared between a rope and
+// its copies from rope_share, and copied on the way down of an edit when
+// they are, so an edit only copies the path it takes.
+typedef struct Rope_Node Rope_Node;
+
+struct Rope_Node {
+    atomic_size_t refs;
+    size_t bytes;
+    size_t newlines;
+    size_t count; // bytes in a leaf, children in a branch
+    bool leaf;
+    char *text;
+    Rope_Node *children[ROPE_BRANCH_MAX];
+};
+
+typedef struct {
+    Rope_Node *root;
+} Rope;
+
+void rope_clear(Rope *rope);
+void rope_end(Rope *rope);
+// Returns a rope with the same text in O(1). Later edits of either leave the
+// other alone, and either may be read from another thread.
+Rope rope_share(const Rope *rope);
+
+size_t rope_size(const Rope *rope);
+size_t rope_newlines(const Rope *rope);
+
+char rope_char_at(const Rope *rope, size_t at);
+const char *rope_span(const Rope *rope, size_t at, size_t *n);
+
+void rope_insert(Rope *rope, const char *s, size_t n, size_t at);
+void rope_delete(Rope *rope, size_t n, size_t from);
+
+// Number of newlines before `at`
+size_t rope_row_of(const Rope *rope, size_t at);
+// Offset of the first byte of `row`; row must not exceed rope_newlines
+size_t rope_row_home(const Rope *rope, size_t row);
+
+#endif // MEDO_DS_ROPE_H_
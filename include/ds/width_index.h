@@ -0,0 +1,56 @@
+#ifndef MEDO_DS_WIDTH_INDEX_H_
+#define MEDO_DS_WIDTH_INDEX_H_
+
+#include "ds/dynamic_array.h"
+#include "ds/fenwick.h"
+#include "ds/char_index.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef WI_BLOCK_MAX
+#  define WI_BLOCK_MAX 4096
+#endif // WI_BLOCK_MAX
+
+// Widths of the lines in a piece of text. Joining two pieces joins the last
+// line of the first with the first line of the second.
+typedef struct {
+    size_t bytes;
+    float head;   // before the first newline, all of the text when there is none
+    float widest; // of the lines between two newlines
+    float tail;   // after the last newline
+    bool newline;
+} Wi_Block;
+
+da_Type(Wi_Blocks, Wi_Block);
+
+// Width of the widest line, kept up to date through edits. The text is cut
+// into blocks of WI_BLOCK_MAX bytes, which edits let grow to twice that,
+// and their widths are joined in a segment tree. An edit measures the
+// blocks it touched again and only walks their path up to the root. The
+// width of a line is the sum of the advances of its bytes, without its
+// newline.
+typedef struct {
+    Wi_Blocks blocks;
+    Fenwick bytes;
+    Wi_Blocks tree;       // root at 1, the blocks from `leaves` on
+    size_t leaves;
+    size_t size;
+    const float *advance; // of every byte value, set before the first use
+} Width_Index;
+
+void wi_clear(Width_Index *wi);
+void wi_end(Width_Index *wi);
+
+// Measures the next n bytes of the text after the ones already measured
+void wi_append(Width_Index *wi, const void *text, Ci_Span span, size_t n);
+
+size_t wi_size(const Width_Index *wi);
+float wi_widest(const Width_Index *wi);
+
+// Updating: `removed` bytes at `from` were replaced by `inserted` bytes,
+// which are already in the text. Only the text up to wi_size is measured,
+// and an edit reaching past it leaves it measured up to the inserted bytes.
+void wi_update(Width_Index *wi, const void *text, Ci_Span span, size_t from, size_t removed, size_t inserted);
+
+#endif // MEDO_DS_WIDTH_INDEX_H_
@@ -59,6 +59,11 @@ typedef enum {
     EK_COPY,
     EK_PASTE,
     EK_CUT,
+    EK_UNDO,
+    EK_REDO,
+    EK_CURSOR_ABOVE,
+    EK_CURSOR_BELOW,
+    EK_CURSOR_NEXT_MATCH,
     EK_ESC,
     EK_COUNT,
 } EditorKey;
@@ -70,10 +75,19 @@ typedef enum {
     EM_BROWSING,
 } EditorMode;
 
+// Anchor is the other end of the selection in EM_SELECTION
+typedef struct {
+    size_t cur;
+    size_t anchor;
+} Cursor;
+
+da_Type(Cursors, Cursor);
+
 typedef struct {
     Basic_Editor be;
 
     size_t select_cur;
+    Cursors cursors; // besides be.cur, sorted by position; edits apply to all of them at once
 
     char *clipboard;
 
@@ -95,6 +109,9 @@ size_t editor_edit(Editor *e, EditorKey key, size_t cur);
 size_t editor_write_at(Editor *e, const char *s, size_t at);
 
 void editor_open(Editor *e, String_View path);
+// Called once per frame: picks up background indexing results and keeps the
+// editor safe from changes made to the open file by other programs
+void editor_update(Editor *e);
 
 #endif // MEDO_EDITOR_H_
 
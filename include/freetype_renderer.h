@@ -32,9 +32,12 @@ typedef struct {
     FT_UInt atlas_w;
     FT_UInt atlas_h;
     GLuint glyph_texture;
-    Glyph_Info gi[128];
+    Glyph_Info gi[256]; // by byte, see ftr_init
 } FreeType_Renderer;
 
+// Text is drawn byte by byte: UTF-8 continuation bytes take no room, and
+// every other byte outside of ASCII draws the replacement character, which
+// shows each multibyte character as a single one
 void ftr_init(FreeType_Renderer *ftr, FT_Face face);
 
 #define ftr_render_s(ftr, sr, s, pos, c) \
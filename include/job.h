@@ -0,0 +1,33 @@
+#ifndef MEDO_JOB_H_
+#define MEDO_JOB_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*Job_Fn)(void *ctx, size_t i);
+
+// Number of threads used by job_parallel_for. Defaults to the number of
+// online cores, or to MEDO_THREADS when that is set in the environment.
+size_t job_threads(void);
+void job_set_threads(size_t n); // 0 restores the default
+
+// Calls fn(ctx, i) for every i in [0, count) on a pool of worker threads and
+// returns once all of them are done. The calling thread takes part as well.
+void job_parallel_for(size_t count, Job_Fn fn, void *ctx);
+
+// A task running on its own background thread. Whatever it shares with its
+// owner is guarded by the job lock, and it should return soon after it sees
+// job_cancelled.
+typedef struct Job Job;
+typedef void (*Job_Task)(Job *job, void *ctx);
+
+Job *job_start(Job_Task task, void *ctx);
+bool job_cancelled(Job *job);
+bool job_done(Job *job);
+void job_lock(Job *job);
+void job_unlock(Job *job);
+// Both block until the task has returned and then free the job
+void job_wait(Job *job);
+void job_cancel(Job *job);
+
+#endif // MEDO_JOB_H_
@@ -26,14 +26,22 @@ typedef struct {
     size_t len;
 } Token;
 
+// Returns the contiguous run of source text starting at `at` and stores its length in `n`
+typedef const char *(*Lexer_Span)(const void *src, size_t at, size_t *n);
+
 typedef struct {
     const char **keywords; // NULL terminated keywords array {"a", "b", "c", NULL}
-    const char *s;
+    const char *s;  // current span of the source, starting at s_home
+    size_t s_home;
+    size_t s_len;
+    Lexer_Span span; // NULL when the whole source is in s
+    const void *src;
     size_t len;
     size_t cur;
 } Lexer;
 
 Lexer lexer_init(const char *s, size_t len, const char **keywords);
+Lexer lexer_init_spans(const void *src, Lexer_Span span, size_t len, const char **keywords);
 Token lexer_next(Lexer *l);
 
 #endif // MEDO_LEXER_H_
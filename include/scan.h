@@ -0,0 +1,55 @@
+#ifndef MEDO_SCAN_H_
+#define MEDO_SCAN_H_
+
+#include <stddef.h>
+
+// Byte scanning kernels. The widest instruction set supported by the CPU is
+// picked on first use; everything also works with the scalar fallback.
+typedef enum {
+    SCAN_ISA_SCALAR = 0,
+    SCAN_ISA_SSE2,
+    SCAN_ISA_AVX2,
+    COUNT_SCAN_ISAS,
+} Scan_Isa;
+
+Scan_Isa scan_isa(void);
+// Falls back to the widest supported instruction set at most `isa`
+void scan_set_isa(Scan_Isa isa);
+const char *scan_isa_name(Scan_Isa isa);
+
+// Writes `base + i` for every newline s[i] into out, which must have room
+// for all of them (n offsets always do). Returns the number of offsets written.
+size_t scan_newlines(const char *s, size_t n, size_t base, size_t *out);
+size_t scan_count_newlines(const char *s, size_t n);
+// Number of newlines right after another newline, which end empty lines.
+// `prev` is the byte before s, taken to be a newline at the start of the text.
+size_t scan_count_blank_lines(const char *s, size_t n, char prev);
+
+// Number of bytes that start a character, which is all but UTF-8
+// continuation bytes
+size_t scan_count_chars(const char *s, size_t n);
+// Length of the longest prefix of s made of whole, valid UTF-8 characters
+size_t scan_utf8_valid(const char *s, size_t n);
+
+// Classes of bytes, shared by the word motions and the lexer. Letters,
+// digits, '_' and the bytes of multibyte UTF-8 characters make up words, and
+// spaces are the bytes isspace takes in the C locale.
+typedef enum {
+    SCAN_CLASS_OTHER = 0,
+    SCAN_CLASS_SPACE,
+    SCAN_CLASS_WORD,
+    COUNT_SCAN_CLASSES,
+} Scan_Class;
+
+#define SCAN_CLASS_BIT(class) (1u << (class))
+
+extern const unsigned char scan_classes[256];
+#define scan_class(c) ((Scan_Class) scan_classes[(unsigned char) (c)])
+
+// Length of the longest prefix of s whose bytes are all of the classes in
+// `set`, made of SCAN_CLASS_BIT, which is where the class next changes
+size_t scan_class_run(const char *s, size_t n, unsigned set);
+// The same for the longest suffix, looking backwards
+size_t scan_class_run_back(const char *s, size_t n, unsigned set);
+
+#endif // MEDO_SCAN_H_
@@ -13,6 +13,7 @@
 #include "editor.h"
 #include "gl_extra.h"
 #include "lexer.h"
+#include "ds/width_index.h"
 
 #include "freetype_renderer.h"
 #include "simple_renderer.h"
@@ -39,6 +40,7 @@
 
 #define SDL_CTRL    ((event.key.keysym.mod & KMOD_CTRL)  != 0)
 #define SDL_SHIFT   ((event.key.keysym.mod & KMOD_SHIFT) != 0)
+#define SDL_ALT     ((event.key.keysym.mod & KMOD_ALT)   != 0)
 
 typedef struct {
     struct {
@@ -65,6 +67,8 @@ typedef struct {
         SDL_Keysym last_key;
         size_t ctrl_a_pressed;
     } state;
+    Width_Index widths; // of the lines of the text, see widest_line
+    float advance[256];
 } Screen;
 
 // SDL check codes
@@ -189,6 +193,122 @@ static const char *keywords[] = {
     NULL
 };
 
+static const char *lexer_be_span(const void *be, size_t at, size_t *n)
+{
+    return be_span(be, at, n);
+}
+
+// The text from `home` on, for lexing only part of a paged file
+typedef struct {
+    const Basic_Editor *be;
+    size_t home;
+} Lexer_Window;
+
+static const char *lexer_window_span(const void *w, size_t at, size_t *n)
+{
+    const Lexer_Window *window = w;
+    return be_span(window->be, window->home + at, n);
+}
+
+// Keeps the width of the lines up to date with the edits since the last
+// frame, and with the text indexed since. A paged file is not measured.
+static float widest_line(const FreeType_Renderer *ftr, Screen *scr, Basic_Editor *be)
+{
+    Width_Index *wi = &scr->widths;
+    if (wi->advance == NULL) {
+        for (size_t i = 0; i < 256; i++) {
+            scr->advance[i] = ftr->gi[i].ax;
+        }
+        wi->advance = scr->advance;
+    }
+
+    Be_Changes changes = be_take_changes(be);
+    if (changes.reset || be_paged(be)) {
+        wi_clear(wi);
+        if (be_paged(be)) return 0;
+    } else if (changes.dirty) {
+        size_t inserted = changes.to - changes.from;
+        wi_update(wi, be, lexer_be_span, changes.from, inserted - changes.delta, inserted);
+    }
+
+    size_t indexed = be_indexed_size(be);
+    if (wi_size(wi) < indexed) wi_append(wi, be, lexer_be_span, indexed - wi_size(wi));
+    return wi_widest(wi);
+}
+
+static float be_get_s_width_n(FreeType_Renderer *ftr, const Basic_Editor *be, size_t from, size_t n)
+{
+    float width = 0;
+    while (n > 0) {
+        size_t len;
+        const char *s = be_span(be, from, &len);
+        if (len == 0) break;
+        if (len > n) len = n;
+        width += ftr_get_s_width_n(ftr, s, len);
+        from += len;
+        n -= len;
+    }
+    return width;
+}
+
+static void render_selection(Simple_Renderer *sr, FreeType_Renderer *ftr, const Screen *scr,
+                             const Basic_Editor *be, size_t select_begin, size_t select_end)
+{
+    if (select_begin > select_end) {
+        size_t tmp = select_begin;
+        select_begin = select_end;
+        select_end = tmp;
+    }
+    size_t row_begin = be_cursor_row(be, select_begin);
+    size_t row_end = be_cursor_row(be, select_end);
+
+    for (size_t row = row_begin; row <= row_end; row++) {
+        Line line = be_line(be, row);
+
+        float select_col_begin = 0;
+        if (row == row_begin) {
+            select_col_begin = select_begin - line.home;
+        }
+
+        float select_col_end = line.end - line.home;
+        if (row == row_end) {
+            select_col_end = select_end - line.home;
+        }
+
+        size_t select_render_begin = 
+            be_get_s_width_n(ftr, be, line.home, select_col_begin);
+
+        size_t select_render_end = 
+            be_get_s_width_n(ftr, be, line.home, select_col_end);
+
+        size_t select_render_width = select_render_end - select_render_begin;
+
+        Vec4f color = hex_to_vec4f(0xC0C0FF30);
+        sr_solid_rect(
+            sr, vec2f(select_render_begin, - (int) row * FONT_SIZE),
+                vec2f(select_render_width, scr->cur.height),
+                color);
+    }
+}
+
+// The extra cursors stand still and do not blink
+static void render_extra_cursors(Simple_Renderer *sr, FreeType_Renderer *ftr, const Screen *scr,
+                                 const Editor *e)
+{
+    for (size_t i = 0; i < e->cursors.size; i++) {
+        Cursor c = e->cursors.data[i];
+        if (e->mode == EM_SELECTION) render_selection(sr, ftr, scr, &e->be, c.anchor, c.cur);
+
+        size_t row = be_cursor_row(&e->be, c.cur);
+        Line line = be_line(&e->be, row);
+        float x = be_get_s_width_n(ftr, &e->be, line.home, c.cur - line.home);
+        sr_solid_rect(
+            sr, vec2f(x, - (int) row * FONT_SIZE),
+                vec2f(CUR_INIT_WIDTH, scr->cur.height),
+                vec4fs(0.75f));
+    }
+}
+
 void renderers_init(Simple_Renderer *sr, FreeType_Renderer *ftr, FT_Face face)
 {
     ftr_init(ftr, face);
@@ -225,14 +345,31 @@ void renderer_draw(SDL_Window *window, Simple_Renderer *sr, FreeType_Renderer *f
 
     // Render Glyphs
     sr_set_shader(sr, SHADER_TEXT);
-    const char *data = e->be.data.data;
     Vec2f pos = {0};
     float line_width = 0;
-    float max_line_width = 0;
-    Lexer l = lexer_init(data, e->be.data.size, keywords);
+    float max_line_width = widest_line(ftr, scr, &e->be);
+    Lexer l = lexer_init_spans(&e->be, lexer_be_span, be_indexed_size(&e->be), keywords);
+    size_t last_i = 0;
+
+    // A paged file may not fit in memory, so only the rows around the camera
+    // are lexed. Tokens spanning the window edges are lexed from the edge.
+    Lexer_Window lw = { .be = &e->be };
+    if (be_paged(&e->be)) {
+        size_t rows = be_line_count(&e->be);
+        float half = 0.5f * scr_height / scr->cam.scale / FONT_SIZE + 1;
+        float center = scr->cam.pos.y / FONT_SIZE;
+        size_t first = (center > half) ? (size_t) (center - half) : 0;
+        size_t last = (center + half > 0) ? (size_t) (center + half) : 0;
+        if (first >= rows) first = rows - 1;
+        if (last >= rows) last = rows - 1;
+
+        lw.home = be_line(&e->be, first).home;
+        l = lexer_init_spans(&lw, lexer_window_span, be_line(&e->be, last).end - lw.home, keywords);
+        last_i = lw.home;
+        pos.y = - (float) first * FONT_SIZE;
+    }
 
     Token token = {0};
-    size_t last_i = 0;
     while ((token = lexer_next(&l)).kind != TOKEN_END) {
         if (token.kind == TOKEN_KEYWORD) {
             sr_set_shader(sr, SHADER_PRIDE);
@@ -253,20 +390,29 @@ void renderer_draw(SDL_Window *window, Simple_Renderer *sr, FreeType_Renderer *f
             default:            color = hex_to_vec4f(0xCFCFCFFF); break;
         }
 
-        for (size_t i = 0; i < token.len; i++) {
-            if (data[last_i + i] == '\n') {
-                line_width = pos.x;
-
-                pos.y -= (float) FONT_SIZE;
-                pos.x = 0;
-            } else {
-                pos = ftr_render_s_n(ftr, sr, data + last_i + i, 1, pos, color);
-                line_width = pos.x;
+        for (size_t i = 0; i < token.len;) {
+            size_t n;
+            const char *s = be_span(&e->be, last_i + i, &n);
+            if (n == 0) break;
+            if (n > token.len - i) n = token.len - i;
+
+            for (size_t j = 0; j < n; j++) {
+                if (s[j] == '\n') {
+                    line_width = pos.x;
+
+                    pos.y -= (float) FONT_SIZE;
+                    pos.x = 0;
+                } else {
+                    pos = ftr_render_s_n(ftr, sr, s + j, 1, pos, color);
+                    line_width = pos.x;
+                }
             }
+            i += n;
         }
         last_i += token.len;
 
-        if (line_width > max_line_width) max_line_width = line_width;
+        // Only the rows drawn of a paged file are measured
+        if (be_paged(&e->be) && line_width > max_line_width) max_line_width = line_width;
     }
 
     // Render Cursor
@@ -283,44 +429,7 @@ void renderer_draw(SDL_Window *window, Simple_Renderer *sr, FreeType_Renderer *f
 
             // Render selection background
             if (e->mode == EM_SELECTION) {
-                size_t select_begin = e->select_cur;
-                size_t select_end = e->be.cur;
-
-                if (select_begin > select_end) {
-                    size_t tmp = select_begin;
-                    select_begin = select_end;
-                    select_end = tmp;
-                }
-                size_t row_begin = be_cursor_row(&e->be, select_begin);
-                size_t row_end = be_cursor_row(&e->be, select_end);
-
-                for (size_t row = row_begin; row <= row_end; row++) {
-                    Line line = e->be.lines.data[row];
-
-                    float select_col_begin = 0;
-                    if (row == row_begin) {
-                        select_col_begin = select_begin - line.home;
-                    }
-
-                    float select_col_end = line.end - line.home;
-                    if (row == row_end) {
-                        select_col_end = select_end - line.home;
-                    }
-
-                    size_t select_render_begin = 
-                        ftr_get_s_width_n(ftr, &e->be.data.data[line.home], select_col_begin);
-
-                    size_t select_render_end = 
-                        ftr_get_s_width_n(ftr, &e->be.data.data[line.home], select_col_end);
-
-                    size_t select_render_width = select_render_end - select_render_begin;
-
-                    Vec4f color = hex_to_vec4f(0xC0C0FF30);
-                    sr_solid_rect(
-                        sr, vec2f(select_render_begin, - (int) row * FONT_SIZE),
-                            vec2f(select_render_width, scr->cur.height),
-                            color);
-                }
+                render_selection(sr, ftr, scr, &e->be, e->select_cur, e->be.cur);
             } else if (e->mode == EM_SEARCHING) {
                 const float search_width = (e->match != -1)
                     ? ftr_get_s_width_n(ftr, e->searchbuf, strlen(e->searchbuf))
@@ -338,6 +447,8 @@ void renderer_draw(SDL_Window *window, Simple_Renderer *sr, FreeType_Renderer *f
         }
 
         case EM_EDITING: {
+            render_extra_cursors(sr, ftr, scr, e);
+
             scr->cur.actual_width = CUR_INIT_WIDTH;
             float CURSOR_BLINK_THRESHOLD = 0.5 * 3.14 / CUR_BLINK_VEL;
             float t = (float) (SDL_GetTicks() - scr->cur.last_moved) / 1000.0f;
@@ -355,11 +466,11 @@ void renderer_draw(SDL_Window *window, Simple_Renderer *sr, FreeType_Renderer *f
         case EM_BROWSING: {
             size_t row = be_cursor_row(&e->be, e->be.cur);
 
-            Line line = e->be.lines.data[row];
+            Line line = be_line(&e->be, row);
             size_t line_size = line.end - line.home;
 
             scr->cur.actual_width = 
-                ftr_get_s_width_n(ftr, &e->be.data.data[line.home], line_size);
+                be_get_s_width_n(ftr, &e->be, line.home, line_size);
 
             scr->cur.render_width +=
                 (scr->cur.actual_width - scr->cur.render_width) * 10 * DELTA_TIME;
@@ -424,6 +535,25 @@ void cursor_move(Screen *scr, size_t pos)
     scr->cur.last_pos = pos;
 }
 
+#define WINDOW_TITLE "Medo Mad EDitOr"
+
+// Shows the progress of background indexing in the title bar
+void update_title(SDL_Window *window, const Editor *e)
+{
+    static int last_percent = -1;
+    int percent = be_indexing(&e->be) ? (int) (be_index_progress(&e->be) * 100) : -1;
+    if (percent == last_percent) return;
+    last_percent = percent;
+
+    char title[64];
+    if (percent < 0) {
+        snprintf(title, sizeof(title), "%s", WINDOW_TITLE);
+    } else {
+        snprintf(title, sizeof(title), "%s - indexing %d%%", WINDOW_TITLE, percent);
+    }
+    SDL_SetWindowTitle(window, title);
+}
+
 static FreeType_Renderer ftr = {0};
 static Simple_Renderer sr = {0};
 
@@ -437,7 +567,7 @@ int main(void)
         gl_attr();
         window = scp(
             SDL_CreateWindow(
-                "Medo Mad EDitOr", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 
+                WINDOW_TITLE, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 
                 SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL)
         );
         scp(SDL_GL_CreateContext(window));
@@ -456,6 +586,8 @@ int main(void)
     bool quit = false;
     while (!quit) {
         const Uint32 start = SDL_GetTicks();
+        editor_update(&e);
+        update_title(window, &e);
 
         SDL_Event event = {0};
         while (SDL_PollEvent(&event)) {
@@ -473,7 +605,9 @@ int main(void)
                         } break;
 
                         case SDLK_UP: {
-                            if (SDL_CTRL && SDL_SHIFT) {
+                            if (SDL_CTRL && SDL_ALT) {
+                                editor_process_key(&e, EK_CURSOR_ABOVE);
+                            } else if (SDL_CTRL && SDL_SHIFT) {
                                 editor_process_key(&e, EK_SELECT_PREV_PARAGRAPH);
                             } else if (SDL_CTRL) {
                                 editor_process_key(&e, EK_PREV_PARAGRAPH);
@@ -486,7 +620,9 @@ int main(void)
                         } break;
 
                         case SDLK_DOWN: {
-                            if (SDL_CTRL && SDL_SHIFT) {
+                            if (SDL_CTRL && SDL_ALT) {
+                                editor_process_key(&e, EK_CURSOR_BELOW);
+                            } else if (SDL_CTRL && SDL_SHIFT) {
                                 editor_process_key(&e, EK_SELECT_NEXT_PARAGRAPH);
                             } else if (SDL_CTRL) {
                                 editor_process_key(&e, EK_NEXT_PARAGRAPH);
@@ -601,6 +737,13 @@ int main(void)
                             }
                         } break;
 
+                        case SDLK_d: {
+                            if (SDL_CTRL) {
+                                editor_process_key(&e, EK_CURSOR_NEXT_MATCH);
+                                update_last_moved(&scr);
+                            }
+                        } break;
+
                         case SDLK_f: {
                             if (SDL_CTRL) {
                                 editor_process_key(&e, EK_SEARCH_START);
@@ -675,6 +818,24 @@ int main(void)
                             }
                         } break;
 
+                        case SDLK_z: {
+                            if (SDL_CTRL) {
+                                if (SDL_SHIFT) {
+                                    editor_process_key(&e, EK_REDO);
+                                } else {
+                                    editor_process_key(&e, EK_UNDO);
+                                }
+                                update_last_moved(&scr);
+                            }
+                        } break;
+
+                        case SDLK_y: {
+                            if (SDL_CTRL) {
+                                editor_process_key(&e, EK_REDO);
+                                update_last_moved(&scr);
+                            }
+                        } break;
+
                         case SDLK_F5: {
                             if (sr_load_shaders(&sr)) {
                                 printf("Reloaded shaders successfully\n");
@@ -688,7 +849,7 @@ int main(void)
                     scr.state.last_key = event.key.keysym;
                 } break;
 
-                static_assert(EK_COUNT == 52, "The number of editor keys has changed");
+                static_assert(EK_COUNT == 57, "The number of editor keys has changed");
 
                 case SDL_TEXTINPUT: {
                     e.be.cur = editor_write_at(&e, event.text.text, e.be.cur);
@@ -698,15 +859,15 @@ int main(void)
         }
 
         // Update cur position on the screen
-        if (e.be.lines.size > 0) {
+        if (be_line_count(&e.be) > 0) {
             size_t row = be_cursor_row(&e.be, e.be.cur);
-            Line line = e.be.lines.data[row];
+            Line line = be_line(&e.be, row);
             size_t col = e.be.cur - line.home;
             size_t line_size = line.end - line.home;
             scr.cur.actual_pos.y = row * FONT_SIZE;
             scr.cur.actual_pos.x = (e.mode != EM_BROWSING)
-                ? ftr_get_s_width_n(&ftr, &e.be.data.data[line.home], col > line_size ? line_size : col)
-                : ftr_get_s_width_n(&ftr, &e.be.data.data[line.home], line_size) / 2;
+                ? be_get_s_width_n(&ftr, &e.be, line.home, col > line_size ? line_size : col)
+                : be_get_s_width_n(&ftr, &e.be, line.home, line_size) / 2;
         }
         
         scr.cur.vel = vec2f_mul(
@@ -729,6 +890,7 @@ int main(void)
     }
 
     editor_clear(&e);
+    wi_end(&scr.widths);
 
     return 0;
 }
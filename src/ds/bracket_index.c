@@ -0,0 +1,515 @@
+#include "ds/bracket_index.h"
+#include "lexer.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef struct {
+    size_t at;
+    bool open;
+} Bi_Bracket;
+
+da_Type(Bi_Brackets, Bi_Bracket);
+
+void bi_clear(Bracket_Index *bi)
+{
+    bi->blocks.size = 0;
+    bi->bytes.size = 0;
+    bi->tree.size = 0;
+    bi->leaves = 0;
+    bi->size = 0;
+    bi->dirty = 0;
+}
+
+void bi_end(Bracket_Index *bi)
+{
+    da_clear(&bi->blocks);
+    da_clear(&bi->bytes);
+    da_clear(&bi->tree);
+    bi->leaves = 0;
+    bi->size = 0;
+    bi->dirty = 0;
+}
+
+static Bi_Block bi_join(Bi_Block a, Bi_Block b)
+{
+    size_t matched = (a.open < b.close) ? a.open : b.close;
+    return (Bi_Block) {
+        .bytes = a.bytes + b.bytes,
+        .close = a.close + b.close - matched,
+        .open = a.open - matched + b.open,
+        .openers = a.openers + b.openers,
+    };
+}
+
+static Bi_Block bi_bracket(Bi_Bracket bracket)
+{
+    return bracket.open
+        ? (Bi_Block) { .open = 1, .openers = 1 }
+        : (Bi_Block) { .close = 1 };
+}
+
+// Trees
+
+static void bi_rebuild_trees(Bracket_Index *bi)
+{
+    size_t n = bi->blocks.size + 1;
+    size_t zero = 0;
+    bi->bytes.size = 0;
+    for (size_t i = 0; i < n; i++) {
+        da_append(&bi->bytes, &zero);
+    }
+    for (size_t i = 1; i < n; i++) {
+        bi->bytes.data[i] += bi->blocks.data[i - 1].bytes;
+        size_t parent = i + (i & -i);
+        if (parent < n) bi->bytes.data[parent] += bi->bytes.data[i];
+    }
+
+    bi->leaves = 1;
+    while (bi->leaves < bi->blocks.size) bi->leaves *= 2;
+    Bi_Block empty = {0};
+    bi->tree.size = 0;
+    for (size_t i = 0; i < 2 * bi->leaves; i++) {
+        da_append(&bi->tree, &empty);
+    }
+    for (size_t b = 0; b < bi->blocks.size; b++) {
+        bi->tree.data[bi->leaves + b] = bi->blocks.data[b];
+    }
+    for (size_t i = bi->leaves - 1; i > 0; i--) {
+        bi->tree.data[i] = bi_join(bi->tree.data[2 * i], bi->tree.data[2 * i + 1]);
+    }
+}
+
+// Joins the path of block b up to the root again
+static void bi_tree_set(Bracket_Index *bi, size_t b)
+{
+    size_t i = bi->leaves + b;
+    bi->tree.data[i] = bi->blocks.data[b];
+    for (i /= 2; i > 0; i /= 2) {
+        bi->tree.data[i] = bi_join(bi->tree.data[2 * i], bi->tree.data[2 * i + 1]);
+    }
+}
+
+// Blocks b1 up to b2 excluded
+static Bi_Block bi_tree_range(const Bracket_Index *bi, size_t b1, size_t b2)
+{
+    Bi_Block left = {0};
+    Bi_Block right = {0};
+    for (size_t lo = bi->leaves + b1, hi = bi->leaves + b2; lo < hi; lo /= 2, hi /= 2) {
+        if (lo & 1) left = bi_join(left, bi->tree.data[lo++]);
+        if (hi & 1) right = bi_join(bi->tree.data[--hi], right);
+    }
+    return bi_join(left, right);
+}
+
+// Joins the blocks before b in front of *acc from right to left, up to the
+// one that brings its unmatched opening brackets to k, which is returned
+// without being joined. SIZE_MAX when no block does.
+static size_t bi_search_left(const Bracket_Index *bi, size_t node, size_t lo, size_t hi,
+                             size_t b, size_t k, Bi_Block *acc)
+{
+    if (lo >= b) return SIZE_MAX;
+    if (hi <= b) {
+        Bi_Block joined = bi_join(bi->tree.data[node], *acc);
+        if (joined.open < k) {
+            *acc = joined;
+            return SIZE_MAX;
+        }
+        if (hi - lo == 1) return lo;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    size_t found = bi_search_left(bi, 2 * node + 1, mid, hi, b, k, acc);
+    if (found != SIZE_MAX) return found;
+    return bi_search_left(bi, 2 * node, lo, mid, b, k, acc);
+}
+
+typedef size_t (*Bi_Count)(Bi_Block block);
+
+static size_t bi_count_close(Bi_Block block)
+{
+    return block.close;
+}
+
+static size_t bi_count_openers(Bi_Block block)
+{
+    return block.openers;
+}
+
+// The same from left to right for the blocks after b, up to the one that
+// brings the count of *acc to k
+static size_t bi_search_right(const Bracket_Index *bi, size_t node, size_t lo, size_t hi,
+                              size_t b, size_t k, Bi_Count count, Bi_Block *acc)
+{
+    if (hi <= b + 1 || lo >= bi->blocks.size) return SIZE_MAX;
+    if (lo > b) {
+        Bi_Block joined = bi_join(*acc, bi->tree.data[node]);
+        if (count(joined) < k) {
+            *acc = joined;
+            return SIZE_MAX;
+        }
+        if (hi - lo == 1) return lo;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    size_t found = bi_search_right(bi, 2 * node, lo, mid, b, k, count, acc);
+    if (found != SIZE_MAX) return found;
+    return bi_search_right(bi, 2 * node + 1, mid, hi, b, k, count, acc);
+}
+
+// Lexing
+
+// The byte at `at`, from the span the lexer read last when it holds it
+static char bi_char_at(const Lexer *l, size_t at)
+{
+    if (at - l->s_home < l->s_len) return l->s[at - l->s_home];
+    size_t len;
+    return *l->span(l->src, at, &len);
+}
+
+static bool bi_is_open(char c)
+{
+    return c == '(' || c == '[' || c == '{';
+}
+
+// Brackets of block b, which starts at `start`
+static void bi_lex_block(const Bracket_Index *bi, const void *text, Ci_Span span,
+                         size_t b, size_t start, Bi_Brackets *brackets)
+{
+    const Bi_Block *block = &bi->blocks.data[b];
+    assert(block->lead != BI_DIRTY);
+    brackets->size = 0;
+    Lexer l = lexer_init_spans(text, span, bi->size, NULL);
+    l.cur = start + block->lead;
+    while (l.cur < start + block->bytes) {
+        size_t at = l.cur;
+        Token token = lexer_next(&l);
+        if (token.kind == TOKEN_END) break;
+        if (token.kind != TOKEN_BRACKET) continue;
+        Bi_Bracket bracket = { at, bi_is_open(bi_char_at(&l, at)) };
+        da_append(brackets, &bracket);
+    }
+}
+
+static void bi_set(Bracket_Index *bi, size_t b, Bi_Block block)
+{
+    if (bi->blocks.data[b].lead == BI_DIRTY) bi->dirty--;
+    bi->blocks.data[b] = block;
+    bi_tree_set(bi, b);
+}
+
+// Lexes dirty block b, which starts at `start`, and the blocks after it until
+// the tokens are back where they were. Returns the first block not lexed.
+static size_t bi_relex(Bracket_Index *bi, const void *text, Ci_Span span, size_t b, size_t start)
+{
+    // The edit may have changed the token before the block, so lexing
+    // starts at the first token of the last block where one starts
+    size_t k = b;
+    size_t ks = start;
+    size_t at = 0;
+    while (k > 0) {
+        const Bi_Block *prev = &bi->blocks.data[--k];
+        ks -= prev->bytes;
+        if (prev->lead < prev->bytes) {
+            at = ks + prev->lead;
+            break;
+        }
+    }
+    assert(k > 0 || ks == 0);
+
+    Lexer l = lexer_init_spans(text, span, bi->size, NULL);
+    l.cur = at;
+    size_t ke = ks + bi->blocks.data[k].bytes;
+    size_t last_dirty = b;
+    Bi_Block fresh = { .bytes = bi->blocks.data[k].bytes, .lead = at - ks };
+    for (;;) {
+        size_t t = l.cur;
+        Token token = lexer_next(&l);
+        if (token.kind == TOKEN_END) t = bi->size;
+
+        // Blocks ending before the token are done
+        while (t >= ke) {
+            bi_set(bi, k, fresh);
+            if (++k == bi->blocks.size) return k;
+            const Bi_Block *next = &bi->blocks.data[k];
+            ks = ke;
+            ke += next->bytes;
+            if (next->lead == BI_DIRTY) last_dirty = k;
+            size_t lead = (t < ke) ? t - ks : next->bytes;
+            // Unchanged text lexed from the same token is lexed as before
+            if (k > last_dirty && lead == next->lead && lead < next->bytes) return k;
+            fresh = (Bi_Block) { .bytes = next->bytes, .lead = lead };
+        }
+
+        if (token.kind == TOKEN_BRACKET) {
+            Bi_Bracket bracket = { t, bi_is_open(bi_char_at(&l, t)) };
+            size_t lead = fresh.lead;
+            fresh = bi_join(fresh, bi_bracket(bracket));
+            fresh.lead = lead;
+        }
+    }
+}
+
+static void bi_mark(Bracket_Index *bi, size_t b)
+{
+    if (bi->blocks.data[b].lead == BI_DIRTY) return;
+    bi->blocks.data[b].lead = BI_DIRTY;
+    bi->dirty++;
+}
+
+static void bi_push(Bracket_Index *bi, size_t bytes)
+{
+    Bi_Block block = { .bytes = bytes, .lead = BI_DIRTY };
+    da_append(&bi->blocks, &block);
+    bi->size += bytes;
+    bi->dirty++;
+    if (bi->blocks.size > bi->leaves) {
+        bi_rebuild_trees(bi);
+        return;
+    }
+    fenwick_push(&bi->bytes, bytes);
+    bi_tree_set(bi, bi->blocks.size - 1);
+}
+
+void bi_sync(Bracket_Index *bi, const void *text, Ci_Span span, size_t size)
+{
+    size_t n = (size > bi->size) ? size - bi->size : 0;
+    if (n > 0 && bi->blocks.size > 0) {
+        // The last token may go on past the old end
+        size_t b = bi->blocks.size - 1;
+        Bi_Block *last = &bi->blocks.data[b];
+        size_t m = (last->bytes < BI_BLOCK_MAX) ? BI_BLOCK_MAX - last->bytes : 0;
+        if (m > n) m = n;
+        last->bytes += m;
+        fenwick_add(&bi->bytes, b, m);
+        bi_mark(bi, b);
+        bi->size += m;
+        n -= m;
+    }
+    while (n > 0) {
+        size_t m = (n < BI_BLOCK_MAX) ? n : BI_BLOCK_MAX;
+        bi_push(bi, m);
+        n -= m;
+    }
+
+    size_t start = 0;
+    for (size_t b = 0; b < bi->blocks.size && bi->dirty > 0;) {
+        if (bi->blocks.data[b].lead != BI_DIRTY) {
+            start += bi->blocks.data[b].bytes;
+            b++;
+            continue;
+        }
+        b = bi_relex(bi, text, span, b, start);
+        start = fenwick_prefix(&bi->bytes, b);
+    }
+    assert(bi->dirty == 0);
+}
+
+// Queries
+
+size_t bi_size(const Bracket_Index *bi)
+{
+    return bi->size;
+}
+
+// Block containing `at`, the last one for the end of the text
+static size_t bi_block_of_offset(const Bracket_Index *bi, size_t at, size_t *start)
+{
+    size_t b = fenwick_search(&bi->bytes, at, start);
+    if (b >= bi->blocks.size) {
+        b = bi->blocks.size - 1;
+        *start = fenwick_prefix(&bi->bytes, b);
+    }
+    return b;
+}
+
+// Brackets between `from` and `to`
+static Bi_Block bi_range(const Bracket_Index *bi, const void *text, Ci_Span span, size_t from, size_t to)
+{
+    Bi_Block range = {0};
+    if (from >= to) return range;
+
+    Bi_Brackets brackets = {0};
+    size_t start1, start2;
+    size_t b1 = bi_block_of_offset(bi, from, &start1);
+    size_t b2 = bi_block_of_offset(bi, to - 1, &start2);
+    bi_lex_block(bi, text, span, b1, start1, &brackets);
+    for (size_t i = 0; i < brackets.size; i++) {
+        Bi_Bracket bracket = brackets.data[i];
+        if (bracket.at >= from && bracket.at < to) range = bi_join(range, bi_bracket(bracket));
+    }
+    if (b2 > b1) {
+        range = bi_join(range, bi_tree_range(bi, b1 + 1, b2));
+        bi_lex_block(bi, text, span, b2, start2, &brackets);
+        for (size_t i = 0; i < brackets.size && brackets.data[i].at < to; i++) {
+            range = bi_join(range, bi_bracket(brackets.data[i]));
+        }
+    }
+    da_clear(&brackets);
+    return range;
+}
+
+// The k-th unmatched opening bracket before `at`, with the brackets from
+// there to `at` summed up in acc. SIZE_MAX when there is none.
+static size_t bi_find_left(const Bracket_Index *bi, const void *text, Ci_Span span,
+                           size_t at, size_t k, Bi_Block acc)
+{
+    Bi_Brackets brackets = {0};
+    size_t start;
+    size_t b = bi_block_of_offset(bi, at, &start);
+    size_t found = SIZE_MAX;
+    for (size_t pass = 0; pass < 2 && found == SIZE_MAX; pass++) {
+        if (pass == 1) {
+            b = bi_search_left(bi, 1, 0, bi->leaves, b, k, &acc);
+            if (b == SIZE_MAX) break;
+            start = fenwick_prefix(&bi->bytes, b);
+        }
+        bi_lex_block(bi, text, span, b, start, &brackets);
+        for (size_t i = brackets.size; i-- > 0;) {
+            Bi_Bracket bracket = brackets.data[i];
+            if (bracket.at >= at) continue;
+            acc = bi_join(bi_bracket(bracket), acc);
+            if (bracket.open && acc.open == k) {
+                found = bracket.at;
+                break;
+            }
+        }
+    }
+    da_clear(&brackets);
+    return found;
+}
+
+// The first bracket from `at` on that brings the count of the brackets from
+// `at` up to it to k. SIZE_MAX when there is none.
+static size_t bi_find_right(const Bracket_Index *bi, const void *text, Ci_Span span,
+                            size_t at, size_t k, Bi_Count count)
+{
+    if (at >= bi->size) return SIZE_MAX;
+
+    Bi_Brackets brackets = {0};
+    Bi_Block acc = {0};
+    size_t start;
+    size_t b = bi_block_of_offset(bi, at, &start);
+    size_t found = SIZE_MAX;
+    for (size_t pass = 0; pass < 2 && found == SIZE_MAX; pass++) {
+        if (pass == 1) {
+            b = bi_search_right(bi, 1, 0, bi->leaves, b, k, count, &acc);
+            if (b == SIZE_MAX) break;
+            start = fenwick_prefix(&bi->bytes, b);
+        }
+        bi_lex_block(bi, text, span, b, start, &brackets);
+        for (size_t i = 0; i < brackets.size; i++) {
+            Bi_Bracket bracket = brackets.data[i];
+            if (bracket.at < at) continue;
+            size_t before = count(acc);
+            acc = bi_join(acc, bi_bracket(bracket));
+            if (count(acc) > before && count(acc) == k) {
+                found = bracket.at;
+                break;
+            }
+        }
+    }
+    da_clear(&brackets);
+    return found;
+}
+
+bool bi_enclosing(const Bracket_Index *bi, const void *text, Ci_Span span, size_t from, size_t to, size_t *open, size_t *close)
+{
+    assert(bi->dirty == 0);
+    *open = *close = SIZE_MAX;
+    if (bi->blocks.size == 0 || from > to || to > bi->size) return false;
+
+    // The closing brackets between them are matched by the first unmatched
+    // opening ones before them, and the one after those opens the pair
+    Bi_Block inside = bi_range(bi, text, span, from, to);
+    *open = bi_find_left(bi, text, span, from, inside.close + 1, (Bi_Block) {0});
+    if (*open == SIZE_MAX) return false;
+    *close = bi_find_right(bi, text, span, to, inside.open + 1, bi_count_close);
+    return *close != SIZE_MAX;
+}
+
+bool bi_next_pair(const Bracket_Index *bi, const void *text, Ci_Span span, size_t at, size_t *open, size_t *close)
+{
+    assert(bi->dirty == 0);
+    *open = *close = SIZE_MAX;
+    if (bi->blocks.size == 0) return false;
+
+    *open = bi_find_right(bi, text, span, at, 1, bi_count_openers);
+    if (*open == SIZE_MAX) return false;
+    *close = bi_find_right(bi, text, span, *open + 1, 1, bi_count_close);
+    return *close != SIZE_MAX;
+}
+
+// Updating
+
+// Forgets the brackets from `at` on
+static void bi_truncate(Bracket_Index *bi, size_t at)
+{
+    if (at >= bi->size) return;
+    size_t start;
+    size_t b = bi_block_of_offset(bi, at, &start);
+    for (size_t i = b; i < bi->blocks.size; i++) {
+        if (bi->blocks.data[i].lead == BI_DIRTY) bi->dirty--;
+    }
+    bi->blocks.size = b;
+    bi->size = start;
+    if (at > start) {
+        Bi_Block block = { .bytes = at - start, .lead = BI_DIRTY };
+        da_append(&bi->blocks, &block);
+        bi->size = at;
+        bi->dirty++;
+    }
+    // The last token was cut by the old end
+    if (bi->blocks.size > 0) bi_mark(bi, bi->blocks.size - 1);
+    bi_rebuild_trees(bi);
+}
+
+void bi_update(Bracket_Index *bi, size_t from, size_t removed, size_t inserted)
+{
+    if (removed == 0 && inserted == 0) return;
+    if (from > bi->size || bi->blocks.size == 0) return;
+    if (from + removed > bi->size) {
+        bi_truncate(bi, from);
+        return;
+    }
+
+    size_t start, last_start;
+    size_t b1 = bi_block_of_offset(bi, from, &start);
+    size_t b2 = (removed > 0) ? bi_block_of_offset(bi, from + removed - 1, &last_start) : b1;
+    size_t end = fenwick_prefix(&bi->bytes, b2 + 1);
+    size_t bytes = end - start - removed + inserted;
+    bi->size += inserted - removed;
+
+    // An edit within a block only marks it. Blocks are let grow up to twice
+    // their size, so that typing into full ones seldom cuts them.
+    if (b1 == b2 && bytes > 0 && bytes <= 2 * BI_BLOCK_MAX) {
+        Bi_Block *block = &bi->blocks.data[b1];
+        fenwick_add(&bi->bytes, b1, bytes - block->bytes);
+        block->bytes = bytes;
+        bi_mark(bi, b1);
+        return;
+    }
+
+    // Otherwise the blocks are cut again, into even parts so that the next
+    // edits find room in them
+    for (size_t i = b1; i <= b2; i++) {
+        if (bi->blocks.data[i].lead == BI_DIRTY) bi->dirty--;
+    }
+    size_t count = (bytes + BI_BLOCK_MAX - 1) / BI_BLOCK_MAX;
+    da_remove_n_from(&bi->blocks, b2 - b1 + 1, b1);
+    if (count > 0) {
+        Bi_Block *parts = malloc(count * sizeof(*parts));
+        assert(parts != NULL);
+        for (size_t j = 0; j < count; j++) {
+            parts[j] = (Bi_Block) { .bytes = bytes / count + (j < bytes % count), .lead = BI_DIRTY };
+        }
+        da_insert_n(&bi->blocks, parts, count, b1);
+        free(parts);
+        bi->dirty += count;
+    } else if (b1 < bi->blocks.size) {
+        // The token before the removed text may now go on into the next block
+        bi_mark(bi, b1);
+    } else if (b1 > 0) {
+        bi_mark(bi, b1 - 1);
+    }
+    bi_rebuild_trees(bi);
+}
@@ -0,0 +1,312 @@
+#include "ds/char_index.h"
+#include "scan.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+void ci_clear(Char_Index *ci)
+{
+    ci->blocks.size = 0;
+    ci->bytes.size = 0;
+    ci->chars.size = 0;
+    ci->size = 0;
+}
+
+void ci_end(Char_Index *ci)
+{
+    da_clear(&ci->blocks);
+    da_clear(&ci->bytes);
+    da_clear(&ci->chars);
+    ci->size = 0;
+}
+
+static_assert(COUNT_CI_UNITS == 3, "The number of units has changed");
+
+static size_t ci_block_max(const Char_Index *ci)
+{
+    return (ci->block_max > 0) ? ci->block_max : CI_BLOCK_MAX;
+}
+
+static size_t ci_scan(Ci_Unit unit, const char *s, size_t n, char prev)
+{
+    switch (unit) {
+        case CI_CHARS:       return scan_count_chars(s, n);
+        case CI_NEWLINES:    return scan_count_newlines(s, n);
+        case CI_BLANK_LINES: return scan_count_blank_lines(s, n, prev);
+        default: assert(0 && "unreachable");
+    }
+    return 0;
+}
+
+static bool ci_is_unit(const Char_Index *ci, char c, char prev)
+{
+    switch (ci->unit) {
+        case CI_CHARS:       return ((unsigned char) c & 0xC0) != 0x80;
+        case CI_NEWLINES:    return c == '\n';
+        case CI_BLANK_LINES: return c == '\n' && prev == '\n';
+        default: assert(0 && "unreachable");
+    }
+    return false;
+}
+
+// The byte before `at`, which only blank lines look at
+static char ci_prev(const Char_Index *ci, const void *text, Ci_Span span, size_t at)
+{
+    if (ci->unit != CI_BLANK_LINES || at == 0) return '\n';
+    size_t len;
+    return *span(text, at - 1, &len);
+}
+
+static size_t ci_count(const Char_Index *ci, const void *text, Ci_Span span, size_t from, size_t n)
+{
+    size_t count = 0;
+    char prev = ci_prev(ci, text, span, from);
+    while (n > 0) {
+        size_t len;
+        const char *s = span(text, from, &len);
+        assert(len > 0);
+        if (len > n) len = n;
+        count += ci_scan(ci->unit, s, len, prev);
+        prev = s[len - 1];
+        from += len;
+        n -= len;
+    }
+    return count;
+}
+
+static void ci_rebuild_trees(Char_Index *ci)
+{
+    size_t n = ci->blocks.size + 1;
+    size_t zero = 0;
+    ci->bytes.size = 0;
+    ci->chars.size = 0;
+    for (size_t i = 0; i < n; i++) {
+        da_append(&ci->bytes, &zero);
+        da_append(&ci->chars, &zero);
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        ci->bytes.data[i] += ci->blocks.data[i - 1].bytes;
+        ci->chars.data[i] += ci->blocks.data[i - 1].chars;
+        size_t parent = i + (i & -i);
+        if (parent < n) {
+            ci->bytes.data[parent] += ci->bytes.data[i];
+            ci->chars.data[parent] += ci->chars.data[i];
+        }
+    }
+}
+
+static void ci_push(Char_Index *ci, Ci_Block block)
+{
+    da_append(&ci->blocks, &block);
+    fenwick_push(&ci->bytes, block.bytes);
+    fenwick_push(&ci->chars, block.chars);
+    ci->size += block.bytes;
+}
+
+// Building
+
+void ci_append(Char_Index *ci, const void *text, Ci_Span span, size_t n)
+{
+    if (ci->blocks.size > 0 && n > 0) {
+        size_t b = ci->blocks.size - 1;
+        Ci_Block *last = &ci->blocks.data[b];
+        size_t m = ci_block_max(ci) - last->bytes;
+        if (m > n) m = n;
+        size_t chars = ci_count(ci, text, span, ci->size, m);
+        last->bytes += m;
+        last->chars += chars;
+        fenwick_add(&ci->bytes, b, m);
+        fenwick_add(&ci->chars, b, chars);
+        ci->size += m;
+        n -= m;
+    }
+    while (n > 0) {
+        size_t m = (n < ci_block_max(ci)) ? n : ci_block_max(ci);
+        ci_push(ci, (Ci_Block) { m, ci_count(ci, text, span, ci->size, m) });
+        n -= m;
+    }
+}
+
+void ci_append_blocks(Char_Index *ci, const Ci_Block *blocks, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        ci_push(ci, blocks[i]);
+    }
+}
+
+size_t ci_make_blocks(Ci_Block *blocks, Ci_Unit unit, const char *s, size_t n, char prev)
+{
+    size_t k = 0;
+    for (size_t at = 0; at < n; at += CI_BLOCK_MAX) {
+        size_t m = (n - at < CI_BLOCK_MAX) ? n - at : CI_BLOCK_MAX;
+        blocks[k++] = (Ci_Block) { m, ci_scan(unit, s + at, m, (at > 0) ? s[at - 1] : prev) };
+    }
+    return k;
+}
+
+// Queries
+
+size_t ci_size(const Char_Index *ci)
+{
+    return ci->size;
+}
+
+size_t ci_total(const Char_Index *ci)
+{
+    return fenwick_prefix(&ci->chars, ci->blocks.size);
+}
+
+// Block containing `at`, the last one for the end of the text
+static size_t ci_block_of_offset(const Char_Index *ci, size_t at, size_t *start)
+{
+    size_t b = fenwick_search(&ci->bytes, at, start);
+    if (b >= ci->blocks.size) {
+        b = ci->blocks.size - 1;
+        *start = fenwick_prefix(&ci->bytes, b);
+    }
+    return b;
+}
+
+// In a block where every byte is a character both lookups are plain offsets
+static bool ci_block_is_ascii(const Char_Index *ci, const Ci_Block *block)
+{
+    return ci->unit == CI_CHARS && block->chars == block->bytes;
+}
+
+size_t ci_char_of(const Char_Index *ci, const void *text, Ci_Span span, size_t at)
+{
+    assert(at <= ci->size);
+    if (ci->blocks.size == 0) return 0;
+
+    size_t start;
+    size_t b = ci_block_of_offset(ci, at, &start);
+    size_t chars = fenwick_prefix(&ci->chars, b);
+    const Ci_Block *block = &ci->blocks.data[b];
+    if (block->chars == 0) return chars;
+    if (ci_block_is_ascii(ci, block)) return chars + (at - start);
+    return chars + ci_count(ci, text, span, start, at - start);
+}
+
+#define CI_SKIP_CHUNK 64
+
+size_t ci_offset_of(const Char_Index *ci, const void *text, Ci_Span span, size_t ch)
+{
+    size_t before;
+    size_t b = fenwick_search(&ci->chars, ch, &before);
+    if (b >= ci->blocks.size) return ci->size;
+
+    size_t at = fenwick_prefix(&ci->bytes, b);
+    size_t k = ch - before; // characters of the block to skip
+    if (ci_block_is_ascii(ci, &ci->blocks.data[b])) return at + k;
+
+    // Chunks are skipped by their counts until the one holding the character
+    char prev = ci_prev(ci, text, span, at);
+    for (;;) {
+        size_t len;
+        const char *s = span(text, at, &len);
+        assert(len > 0);
+        for (size_t i = 0; i < len;) {
+            size_t m = (len - i < CI_SKIP_CHUNK) ? len - i : CI_SKIP_CHUNK;
+            size_t count = ci_scan(ci->unit, s + i, m, prev);
+            if (count <= k) {
+                k -= count;
+                i += m;
+                prev = s[i - 1];
+                continue;
+            }
+            for (;; i++) {
+                if (!ci_is_unit(ci, s[i], prev)) {
+                    prev = s[i];
+                    continue;
+                }
+                if (k == 0) return at + i;
+                k--;
+                prev = s[i];
+            }
+        }
+        at += len;
+    }
+}
+
+// Updating
+
+// A blank line is ended by a newline right after another one. Typing at
+// `from` puts the typed bytes between the byte after them and the one
+// before `from`, which may start or stop a blank line ending there.
+static size_t ci_blank_shift(const Char_Index *ci, const void *text, Ci_Span span, size_t from, size_t inserted)
+{
+    size_t len;
+    if (*span(text, from + inserted, &len) != '\n') return 0;
+    bool was = ci_prev(ci, text, span, from) == '\n';
+    bool is = *span(text, from + inserted - 1, &len) == '\n';
+    return (size_t) is - (size_t) was;
+}
+
+// An edit ending at the start of block b may have changed the byte before
+// it, which decides whether its first byte ends a blank line, and what the
+// byte was is no longer known. So the block is counted again.
+static void ci_recount(Char_Index *ci, const void *text, Ci_Span span, size_t b, size_t start, bool trees)
+{
+    if (ci->unit != CI_BLANK_LINES || b >= ci->blocks.size) return;
+    Ci_Block *block = &ci->blocks.data[b];
+    size_t chars = ci_count(ci, text, span, start, block->bytes);
+    if (trees) fenwick_add(&ci->chars, b, chars - block->chars);
+    block->chars = chars;
+}
+
+void ci_update(Char_Index *ci, const void *text, Ci_Span span, size_t from, size_t removed, size_t inserted)
+{
+    assert(from + removed <= ci->size);
+    if (removed == 0 && inserted == 0) return;
+    if (ci->blocks.size == 0) {
+        ci_append(ci, text, span, inserted);
+        return;
+    }
+
+    size_t start, last_start;
+    size_t b1 = ci_block_of_offset(ci, from, &start);
+    size_t b2 = (removed > 0) ? ci_block_of_offset(ci, from + removed - 1, &last_start) : b1;
+    size_t end = fenwick_prefix(&ci->bytes, b2 + 1);
+    size_t bytes = end - start - removed + inserted;
+    size_t after = from + inserted; // first byte after the edit
+    ci->size += inserted - removed;
+
+    // Typing into a block with room to spare only counts what was typed, and
+    // other edits within a block count it again
+    if (b1 == b2 && bytes > 0 && bytes <= ci_block_max(ci)) {
+        Ci_Block *block = &ci->blocks.data[b1];
+        size_t chars = (removed == 0)
+            ? block->chars + ci_count(ci, text, span, from, inserted)
+            : ci_count(ci, text, span, start, bytes);
+        if (removed == 0 && ci->unit == CI_BLANK_LINES && after < start + bytes) {
+            chars += ci_blank_shift(ci, text, span, from, inserted);
+        }
+        fenwick_add(&ci->bytes, b1, bytes - block->bytes);
+        fenwick_add(&ci->chars, b1, chars - block->chars);
+        block->bytes = bytes;
+        block->chars = chars;
+        if (after == start + bytes) ci_recount(ci, text, span, b1 + 1, after, true);
+        return;
+    }
+
+    // Otherwise the blocks are cut again, into even parts so that the next
+    // edits find room in them
+    size_t count = (bytes + ci_block_max(ci) - 1) / ci_block_max(ci);
+    da_remove_n_from(&ci->blocks, b2 - b1 + 1, b1);
+    if (count > 0) {
+        Ci_Block *parts = malloc(count * sizeof(*parts));
+        assert(parts != NULL);
+        size_t at = start;
+        for (size_t j = 0; j < count; j++) {
+            size_t m = bytes / count + (j < bytes % count);
+            parts[j] = (Ci_Block) { m, ci_count(ci, text, span, at, m) };
+            at += m;
+        }
+        da_insert_n(&ci->blocks, parts, count, b1);
+        free(parts);
+    }
+    if (after == start + bytes) ci_recount(ci, text, span, b1 + count, after, false);
+    ci_rebuild_trees(ci);
+}
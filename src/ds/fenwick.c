@@ -0,0 +1,44 @@
+#include "ds/fenwick.h"
+
+size_t fenwick_prefix(const Fenwick *t, size_t n)
+{
+    size_t sum = 0;
+    for (; n > 0; n &= n - 1) {
+        sum += t->data[n];
+    }
+    return sum;
+}
+
+void fenwick_add(Fenwick *t, size_t i, size_t delta)
+{
+    for (i++; i < t->size; i += i & -i) {
+        t->data[i] += delta;
+    }
+}
+
+size_t fenwick_search(const Fenwick *t, size_t x, size_t *sum)
+{
+    size_t step = 1;
+    while (step * 2 < t->size) step *= 2;
+
+    size_t n = 0;
+    *sum = 0;
+    for (; step > 0; step /= 2) {
+        if (n + step < t->size && *sum + t->data[n + step] <= x) {
+            n += step;
+            *sum += t->data[n];
+        }
+    }
+    return n;
+}
+
+// Node i covers the values (i - lowbit(i), i], all but the new one already in the tree
+void fenwick_push(Fenwick *t, size_t value)
+{
+    size_t zero = 0;
+    if (t->size == 0) da_append(t, &zero);
+
+    size_t i = t->size;
+    size_t node = value + fenwick_prefix(t, i - 1) - fenwick_prefix(t, i - (i & -i));
+    da_append(t, &node);
+}
@@ -0,0 +1,109 @@
+#include "ds/gap_buffer.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+void gb_init(Gap_Buffer *gb, char *data, size_t size)
+{
+    gb->capacity = size + GB_MIN_GAP;
+    gb->data = realloc(data, gb->capacity);
+    assert(gb->data != NULL);
+    gb->gap_home = size;
+    gb->gap_end = gb->capacity;
+}
+
+void gb_clear(Gap_Buffer *gb)
+{
+    gb->gap_home = 0;
+    gb->gap_end = gb->capacity;
+}
+
+void gb_end(Gap_Buffer *gb)
+{
+    free(gb->data);
+    gb->data = NULL;
+    gb->capacity = 0;
+    gb->gap_home = 0;
+    gb->gap_end = 0;
+}
+
+char gb_char_at(const Gap_Buffer *gb, size_t at)
+{
+    assert(at < gb_size(gb));
+    if (at >= gb->gap_home) at += gb->gap_end - gb->gap_home;
+    return gb->data[at];
+}
+
+const char *gb_span(const Gap_Buffer *gb, size_t at, size_t *n)
+{
+    size_t size = gb_size(gb);
+    if (at >= size) {
+        *n = 0;
+        return NULL;
+    }
+    if (at < gb->gap_home) {
+        *n = gb->gap_home - at;
+        return gb->data + at;
+    }
+    *n = size - at;
+    return gb->data + at + (gb->gap_end - gb->gap_home);
+}
+
+static void gb_move_gap(Gap_Buffer *gb, size_t at)
+{
+    if (at < gb->gap_home) {
+        size_t n = gb->gap_home - at;
+        memmove(gb->data + gb->gap_end - n, gb->data + at, n);
+        gb->gap_home -= n;
+        gb->gap_end -= n;
+    } else if (at > gb->gap_home) {
+        size_t n = at - gb->gap_home;
+        memmove(gb->data + gb->gap_home, gb->data + gb->gap_end, n);
+        gb->gap_home += n;
+        gb->gap_end += n;
+    }
+}
+
+// Grows the buffer geometrically so that a long run of insertions only
+// reallocates a logarithmic number of times
+static void gb_reserve(Gap_Buffer *gb, size_t n)
+{
+    if (gb->gap_end - gb->gap_home >= n) return;
+
+    size_t tail = gb->capacity - gb->gap_end;
+    size_t capacity = gb->capacity * 2;
+    if (capacity < gb_size(gb) + n + GB_MIN_GAP) {
+        capacity = gb_size(gb) + n + GB_MIN_GAP;
+    }
+
+    gb->data = realloc(gb->data, capacity);
+    assert(gb->data != NULL);
+    memmove(gb->data + capacity - tail, gb->data + gb->gap_end, tail);
+    gb->gap_end = capacity - tail;
+    gb->capacity = capacity;
+}
+
+void gb_insert(Gap_Buffer *gb, const char *s, size_t n, size_t at)
+{
+    assert(at <= gb_size(gb));
+    if (n == 0) return;
+
+    gb_move_gap(gb, at);
+    gb_reserve(gb, n);
+    memcpy(gb->data + gb->gap_home, s, n);
+    gb->gap_home += n;
+}
+
+void gb_delete(Gap_Buffer *gb, size_t n, size_t from)
+{
+    assert(from + n <= gb_size(gb));
+    if (n == 0) return;
+
+    if (from + n == gb->gap_home) {
+        gb->gap_home = from; // backspacing right before the gap
+        return;
+    }
+    gb_move_gap(gb, from);
+    gb->gap_end += n;
+}
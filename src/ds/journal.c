@@ -0,0 +1,228 @@
+#include "ds/journal.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+void jn_clear(Journal *jn)
+{
+    jn->deltas.size = 0;
+    jn->bytes.size = 0;
+    jn->first = 0;
+    jn->done = 0;
+    jn->group = 0;
+    jn->sealed = true;
+}
+
+void jn_end(Journal *jn)
+{
+    da_clear(&jn->deltas);
+    da_clear(&jn->bytes);
+    jn_clear(jn);
+}
+
+static size_t jn_limit(const Journal *jn)
+{
+    return (jn->limit > 0) ? jn->limit : JN_LIMIT;
+}
+
+// Bytes before this offset belong to deltas that were dropped
+static size_t jn_dropped_bytes(const Journal *jn)
+{
+    return (jn->first < jn->deltas.size) ? jn->deltas.data[jn->first].data : jn->bytes.size;
+}
+
+size_t jn_memory(const Journal *jn)
+{
+    return (jn->deltas.size - jn->first) * sizeof(Jn_Delta) + jn->bytes.size - jn_dropped_bytes(jn);
+}
+
+static void jn_drop_redo(Journal *jn)
+{
+    if (jn->done == jn->deltas.size) return;
+    jn->bytes.size = jn->deltas.data[jn->done].data;
+    jn->deltas.size = jn->done;
+}
+
+static void jn_drop_step(Journal *jn)
+{
+    assert(jn->first < jn->done);
+    do {
+        jn->first++;
+    } while (jn->first < jn->done && jn->deltas.data[jn->first].joined);
+}
+
+// Moves what is left to the front once the dropped part is half the arrays,
+// so that the cost of dropping stays constant per delta
+static void jn_compact(Journal *jn)
+{
+    size_t dropped = jn_dropped_bytes(jn);
+    if (2 * jn->first < jn->deltas.size && 2 * dropped < jn->bytes.size) return;
+
+    memmove(jn->bytes.data, jn->bytes.data + dropped, jn->bytes.size - dropped);
+    jn->bytes.size -= dropped;
+    for (size_t i = jn->first; i < jn->deltas.size; i++) {
+        jn->deltas.data[i].data -= dropped;
+    }
+    memmove(jn->deltas.data, jn->deltas.data + jn->first, (jn->deltas.size - jn->first) * sizeof(Jn_Delta));
+    jn->deltas.size -= jn->first;
+    jn->done -= jn->first;
+    jn->first = 0;
+}
+
+void jn_set_limit(Journal *jn, size_t limit)
+{
+    jn->limit = limit;
+    while (jn_memory(jn) > jn_limit(jn) && jn->first < jn->done) {
+        jn_drop_step(jn);
+    }
+    if (jn_memory(jn) > jn_limit(jn)) jn_drop_redo(jn);
+    if (jn->first > 0) jn_compact(jn);
+}
+
+// Drops the oldest steps until `n` more bytes and a delta fit in the limit.
+// When they never could, the whole history goes, as none of it would still
+// apply to the text after the edit.
+static bool jn_make_room(Journal *jn, size_t n)
+{
+    jn_drop_redo(jn);
+    size_t need = n + sizeof(Jn_Delta);
+    if (need > jn_limit(jn)) {
+        size_t group = jn->group;
+        jn_clear(jn);
+        jn->group = group;
+        return false;
+    }
+    while (jn_memory(jn) + need > jn_limit(jn)) {
+        jn_drop_step(jn);
+    }
+    if (jn->first > 0) jn_compact(jn);
+    return true;
+}
+
+// Appends n bytes and returns them
+static char *jn_grow(Journal *jn, size_t n)
+{
+    size_t size = jn->bytes.size + n;
+    if (size > jn->bytes.capacity) {
+        size_t capacity = (jn->bytes.capacity > 0) ? 2 * jn->bytes.capacity : 256;
+        while (capacity < size) capacity *= 2;
+        jn->bytes.data = realloc(jn->bytes.data, capacity);
+        assert(jn->bytes.data != NULL);
+        jn->bytes.capacity = capacity;
+    }
+    char *p = jn->bytes.data + jn->bytes.size;
+    jn->bytes.size = size;
+    return p;
+}
+
+// The delta a new edit may extend, NULL when it has to start a new one
+static Jn_Delta *jn_last(Journal *jn)
+{
+    if (jn->sealed || jn->done == jn->first) return NULL;
+    Jn_Delta *last = &jn->deltas.data[jn->done - 1];
+    return last;
+}
+
+static char *jn_push(Journal *jn, size_t at, size_t removed, size_t inserted)
+{
+    Jn_Delta delta = {
+        .at = at,
+        .removed = removed,
+        .inserted = inserted,
+        .data = jn->bytes.size,
+        .joined = jn->group > 0 && jn_last(jn) != NULL,
+    };
+    da_append(&jn->deltas, &delta);
+    jn->done = jn->deltas.size;
+    jn->sealed = false;
+    return jn_grow(jn, removed + inserted);
+}
+
+void jn_insert(Journal *jn, const char *s, size_t n, size_t at)
+{
+    if (n == 0) return;
+    if (!jn_make_room(jn, n)) return;
+
+    // Typing goes on in the same delta, and a step ends with a line
+    Jn_Delta *last = jn_last(jn);
+    if (last != NULL && last->at + last->inserted == at
+        && last->removed + last->inserted + n <= JN_RUN_MAX
+        && (last->inserted == 0 || jn_inserted(jn, last)[last->inserted - 1] != '\n')) {
+        memcpy(jn_grow(jn, n), s, n);
+        last->inserted += n;
+        return;
+    }
+    memcpy(jn_push(jn, at, 0, n), s, n);
+}
+
+char *jn_delete(Journal *jn, size_t n, size_t from)
+{
+    assert(n > 0);
+    if (!jn_make_room(jn, n)) return NULL;
+
+    Jn_Delta *last = jn_last(jn);
+    if (last != NULL && last->removed + last->inserted + n <= JN_RUN_MAX) {
+        if (from + n == last->at + last->inserted && last->inserted >= n) {
+            // Erasing what was just typed only takes it back. The bytes the
+            // caller copies land in the space freed at the end.
+            last->inserted -= n;
+            jn->bytes.size -= n;
+            return jn->bytes.data + jn->bytes.size;
+        }
+        if (last->inserted == 0 && from == last->at) { // delete
+            char *p = jn_grow(jn, n);
+            last->removed += n;
+            return p;
+        }
+        if (last->inserted == 0 && from + n == last->at) { // backspace
+            jn_grow(jn, n);
+            char *p = jn_removed(jn, last);
+            memmove(p + n, p, last->removed);
+            last->at = from;
+            last->removed += n;
+            return p;
+        }
+    }
+    return jn_push(jn, from, n, 0);
+}
+
+void jn_seal(Journal *jn)
+{
+    jn->sealed = true;
+}
+
+void jn_begin(Journal *jn)
+{
+    if (jn->group++ == 0) jn->sealed = true;
+}
+
+void jn_commit(Journal *jn)
+{
+    assert(jn->group > 0);
+    if (--jn->group == 0) jn->sealed = true;
+}
+
+size_t jn_undo(Journal *jn)
+{
+    jn->sealed = true;
+    size_t n = 0;
+    while (jn->done > jn->first) {
+        jn->done--;
+        n++;
+        if (!jn->deltas.data[jn->done].joined) break;
+    }
+    return n;
+}
+
+size_t jn_redo(Journal *jn)
+{
+    jn->sealed = true;
+    if (jn->done == jn->deltas.size) return 0;
+    size_t n = 0;
+    do {
+        jn->done++;
+        n++;
+    } while (jn->done < jn->deltas.size && jn->deltas.data[jn->done].joined);
+    return n;
+}
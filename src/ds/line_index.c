@@ -0,0 +1,529 @@
+#include "ds/line_index.h"
+#include "job.h"
+#include "scan.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void li_rebuild_trees(Line_Index *li)
+{
+    size_t n = li->blocks.size + 1;
+    size_t zero = 0;
+    li->bytes.size = 0;
+    li->rows.size = 0;
+    for (size_t i = 0; i < n; i++) {
+        da_append(&li->bytes, &zero);
+        da_append(&li->rows, &zero);
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        li->bytes.data[i] += li->blocks.data[i - 1].bytes;
+        li->rows.data[i] += li->blocks.data[i - 1].homes.size;
+        size_t parent = i + (i & -i);
+        if (parent < n) {
+            li->bytes.data[parent] += li->bytes.data[i];
+            li->rows.data[parent] += li->rows.data[i];
+        }
+    }
+}
+
+void li_clear(Line_Index *li)
+{
+    for (size_t i = 0; i < li->blocks.size; i++) {
+        da_clear(&li->blocks.data[i].homes);
+    }
+    li->blocks.size = 0;
+    li->bytes.size = 0;
+    li->rows.size = 0;
+    li->row_count = 0;
+    li->version++;
+    li->home = 0;
+    li->block_home = 0;
+}
+
+void li_end(Line_Index *li)
+{
+    li_clear(li);
+    da_clear(&li->blocks);
+    da_clear(&li->bytes);
+    da_clear(&li->rows);
+}
+
+// Line i of block b relative to the block. The last line of the text ends
+// with it, every other one at the newline before the next home.
+static Line li_block_line(const Line_Index *li, size_t b, size_t i)
+{
+    const Line_Block *block = &li->blocks.data[b];
+    Line line = { block->homes.data[i], 0 };
+    if (i + 1 < block->homes.size) {
+        line.end = (size_t) block->homes.data[i + 1] - 1;
+    } else {
+        line.end = (b + 1 < li->blocks.size) ? block->bytes - 1 : block->bytes;
+    }
+    return line;
+}
+
+// Building
+
+static void li_push(Line_Index *li)
+{
+    Line_Block *block = (li->blocks.size > 0) ? &li->blocks.data[li->blocks.size - 1] : NULL;
+    if (block == NULL || block->homes.size >= LI_BLOCK_MAX || li->home - li->block_home > LI_HOME_MAX) {
+        if (block != NULL) block->bytes = li->home - li->block_home;
+        Line_Block empty = {0};
+        da_append(&li->blocks, &empty);
+        block = &li->blocks.data[li->blocks.size - 1];
+        li->block_home = li->home;
+    }
+
+    Li_Home home = li->home - li->block_home;
+    da_append(&block->homes, &home);
+    li->row_count++;
+}
+
+void li_append(Line_Index *li, size_t newline)
+{
+    li_push(li);
+    li->home = newline + 1;
+}
+
+void li_append_n(Line_Index *li, const size_t *newlines, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        li_push(li);
+        li->home = newlines[i] + 1;
+    }
+}
+
+void li_finish(Line_Index *li, size_t size)
+{
+    li_push(li);
+    li->blocks.data[li->blocks.size - 1].bytes = size - li->block_home;
+    li_rebuild_trees(li);
+    li->version++;
+}
+
+void li_append_blocks(Line_Index *li, Line_Block *blocks, size_t n, bool last)
+{
+    if (n == 0) return;
+
+    // The current last line continues into the first line of the blocks,
+    // which moves over to its block
+    Line_Block *tail = &li->blocks.data[li->blocks.size - 1];
+    Li_Homes *homes = &blocks[0].homes;
+    if (homes->size > 1) {
+        Li_Home len = homes->data[1];
+        tail->bytes += len;
+        da_remove_from(homes, 0);
+        for (size_t i = 0; i < homes->size; i++) {
+            homes->data[i] -= len;
+        }
+        blocks[0].bytes -= len;
+    } else {
+        tail->bytes += blocks[0].bytes;
+        da_clear(homes);
+        blocks++;
+        n--;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        li->row_count += blocks[i].homes.size;
+    }
+    if (n > 0) da_append_n(&li->blocks, blocks, n);
+
+    if (!last) {
+        Line_Block block = {0};
+        Li_Home empty = 0;
+        da_append(&block.homes, &empty);
+        da_append(&li->blocks, &block);
+        li->row_count++;
+    }
+
+    li_rebuild_trees(li);
+    li->version++;
+}
+
+typedef struct {
+    Line_Index *li;
+    const size_t *newlines;
+    size_t n;
+    size_t size;
+} Li_Build;
+
+static size_t li_build_home(const Li_Build *build, size_t row)
+{
+    return (row > 0) ? build->newlines[row - 1] + 1 : 0;
+}
+
+static void li_build_block(void *ctx, size_t b)
+{
+    const Li_Build *build = ctx;
+    Line_Block *block = &build->li->blocks.data[b];
+    size_t first = b * LI_BLOCK_MAX;
+    size_t last = first + block->homes.capacity;
+    size_t block_home = li_build_home(build, first);
+
+    for (size_t row = first; row < last; row++) {
+        block->homes.data[row - first] = li_build_home(build, row) - block_home;
+    }
+    block->homes.size = block->homes.capacity;
+
+    size_t next_home = (last <= build->n) ? li_build_home(build, last) : build->size;
+    block->bytes = next_home - block_home;
+}
+
+void li_build(Line_Index *li, const size_t *newlines, size_t n, size_t size)
+{
+    li_clear(li);
+
+    size_t rows = n + 1;
+    size_t count = (rows + LI_BLOCK_MAX - 1) / LI_BLOCK_MAX;
+    Li_Build build = { li, newlines, n, size };
+
+    // Blocks of lines that long are cut where their homes stop fitting, one line at a time
+    for (size_t b = 0; b < count; b++) {
+        size_t first = b * LI_BLOCK_MAX;
+        size_t last = (rows - first < LI_BLOCK_MAX) ? rows - 1 : first + LI_BLOCK_MAX - 1;
+        if (li_build_home(&build, last) - li_build_home(&build, first) > LI_HOME_MAX) {
+            li_append_n(li, newlines, n);
+            li_finish(li, size);
+            return;
+        }
+    }
+
+    for (size_t b = 0; b < count; b++) {
+        size_t k = (rows - b * LI_BLOCK_MAX < LI_BLOCK_MAX) ? rows - b * LI_BLOCK_MAX : LI_BLOCK_MAX;
+        Line_Block block = {0};
+        block.homes.capacity = k;
+        block.homes.data = malloc(k * sizeof(*block.homes.data));
+        assert(block.homes.data != NULL);
+        da_append(&li->blocks, &block);
+    }
+
+    job_parallel_for(count, li_build_block, &build);
+
+    li->row_count = rows;
+    li->home = li_build_home(&build, n);
+    li->block_home = li_build_home(&build, (count - 1) * LI_BLOCK_MAX);
+    li_rebuild_trees(li);
+    li->version++;
+}
+
+// Queries
+
+size_t li_row_count(const Line_Index *li)
+{
+    return li->row_count;
+}
+
+static size_t li_block_of_offset(const Line_Index *li, size_t at, size_t *start)
+{
+    size_t b = fenwick_search(&li->bytes, at, start);
+    if (b >= li->blocks.size) {
+        b = li->blocks.size - 1;
+        *start = fenwick_prefix(&li->bytes, b);
+    }
+    return b;
+}
+
+static size_t li_block_of_row(const Line_Index *li, size_t row, size_t *first)
+{
+    assert(row < li->row_count);
+    return fenwick_search(&li->rows, row, first);
+}
+
+static bool li_hint_valid(const Line_Index *li, const Li_Hint *hint)
+{
+    return hint->version == li->version && hint->block < li->blocks.size;
+}
+
+static void li_hint_set(const Line_Index *li, Li_Hint *hint, size_t b)
+{
+    hint->version = li->version;
+    hint->block = b;
+    hint->first = fenwick_prefix(&li->rows, b);
+    hint->start = fenwick_prefix(&li->bytes, b);
+}
+
+size_t li_row_of_hint(const Line_Index *li, size_t at, Li_Hint *hint)
+{
+    assert(li->blocks.size > 0);
+    bool last = hint->block + 1 == li->blocks.size;
+    if (!li_hint_valid(li, hint) || at < hint->start ||
+        (!last && at - hint->start >= li->blocks.data[hint->block].bytes))
+    {
+        size_t start;
+        li_hint_set(li, hint, li_block_of_offset(li, at, &start));
+    }
+
+    // Last line whose home is not past `at`
+    const Li_Homes *homes = &li->blocks.data[hint->block].homes;
+    size_t rel = at - hint->start;
+    size_t lo = 0;
+    size_t hi = homes->size;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (homes->data[mid] <= rel) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return hint->first + lo;
+}
+
+Line li_line_hint(const Line_Index *li, size_t row, Li_Hint *hint)
+{
+    if (!li_hint_valid(li, hint) || row < hint->first ||
+        row - hint->first >= li->blocks.data[hint->block].homes.size)
+    {
+        size_t first;
+        li_hint_set(li, hint, li_block_of_row(li, row, &first));
+    }
+
+    Line line = li_block_line(li, hint->block, row - hint->first);
+    line.home += hint->start;
+    line.end += hint->start;
+    return line;
+}
+
+size_t li_row_of(const Line_Index *li, size_t at)
+{
+    Li_Hint hint = {0};
+    return li_row_of_hint(li, at, &hint);
+}
+
+Line li_line(const Line_Index *li, size_t row)
+{
+    Li_Hint hint = {0};
+    return li_line_hint(li, row, &hint);
+}
+
+// Updating
+
+// Splits an oversized block into blocks of LI_BLOCK_MAX lines
+static void li_split_block(Line_Index *li, size_t b)
+{
+    Line_Block block = li->blocks.data[b];
+    size_t count = (block.homes.size + LI_BLOCK_MAX - 1) / LI_BLOCK_MAX;
+
+    Line_Block *parts = calloc(count, sizeof(*parts));
+    assert(parts != NULL);
+    for (size_t j = 0; j < count; j++) {
+        size_t from = j * LI_BLOCK_MAX;
+        size_t n = (block.homes.size - from < LI_BLOCK_MAX) ? block.homes.size - from : LI_BLOCK_MAX;
+        size_t home = block.homes.data[from];
+        size_t next = (j + 1 < count) ? block.homes.data[from + n] : block.bytes;
+
+        da_append_n(&parts[j].homes, &block.homes.data[from], n);
+        for (size_t i = 0; i < n; i++) {
+            parts[j].homes.data[i] -= home;
+        }
+        parts[j].bytes = next - home;
+    }
+
+    da_clear(&block.homes);
+    da_remove_from(&li->blocks, b);
+    da_insert_n(&li->blocks, parts, count, b);
+    free(parts);
+}
+
+// Appends block b + 1 to block b
+static void li_merge_blocks(Line_Index *li, size_t b)
+{
+    Line_Block *block = &li->blocks.data[b];
+    Line_Block *next = &li->blocks.data[b + 1];
+    size_t shift = block->bytes;
+
+    size_t i = block->homes.size;
+    da_append_n(&block->homes, next->homes.data, next->homes.size);
+    for (; i < block->homes.size; i++) {
+        block->homes.data[i] += shift;
+    }
+    block->bytes += next->bytes;
+
+    da_clear(&next->homes);
+    da_remove_from(&li->blocks, b + 1);
+}
+
+// Whether block b + 1 fits into block b, both in lines and in the reach of its homes
+static bool li_mergeable(const Line_Index *li, size_t b)
+{
+    const Line_Block *block = &li->blocks.data[b];
+    const Line_Block *next = &li->blocks.data[b + 1];
+    return block->homes.size + next->homes.size <= LI_BLOCK_MAX
+        && block->bytes + next->homes.data[next->homes.size - 1] <= LI_HOME_MAX;
+}
+
+// Keeps blocks between LI_BLOCK_MAX / 4 and 2 * LI_BLOCK_MAX lines where
+// possible. Returns true if the block layout changed.
+static bool li_rebalance(Line_Index *li, size_t b)
+{
+    size_t rows = li->blocks.data[b].homes.size;
+    if (rows > 2 * LI_BLOCK_MAX) {
+        li_split_block(li, b);
+        return true;
+    }
+    if (rows < LI_BLOCK_MAX / 4) {
+        if (b + 1 < li->blocks.size && li_mergeable(li, b)) {
+            li_merge_blocks(li, b);
+            return true;
+        }
+        if (b > 0 && li_mergeable(li, b - 1)) {
+            li_merge_blocks(li, b - 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Replaces blocks b1 to b2 with blocks cut afresh from the `n` given homes,
+// the last line ending at `end`
+static void li_recut(Line_Index *li, size_t b1, size_t b2, const size_t *homes, size_t n, size_t end)
+{
+    for (size_t b = b1; b <= b2; b++) {
+        da_clear(&li->blocks.data[b].homes);
+    }
+    da_remove_n_from(&li->blocks, b2 - b1 + 1, b1);
+
+    Line_Blocks parts = {0};
+    size_t block_home = homes[0];
+    for (size_t i = 0; i < n; i++) {
+        Line_Block *part = (parts.size > 0) ? &parts.data[parts.size - 1] : NULL;
+        if (part == NULL || part->homes.size >= LI_BLOCK_MAX || homes[i] - block_home > LI_HOME_MAX) {
+            if (part != NULL) part->bytes = homes[i] - block_home;
+            Line_Block empty = {0};
+            da_append(&parts, &empty);
+            part = &parts.data[parts.size - 1];
+            block_home = homes[i];
+        }
+        Li_Home home = homes[i] - block_home;
+        da_append(&part->homes, &home);
+    }
+    parts.data[parts.size - 1].bytes = end - block_home;
+
+    da_insert_n(&li->blocks, parts.data, parts.size, b1);
+    da_clear(&parts);
+}
+
+// Replaces rows [r1, r2] with k new lines whose homes are given in post-edit
+// offsets. Everything after r2 moves by inserted - removed bytes.
+static void li_replace(Line_Index *li, size_t r1, size_t r2, const size_t *homes, size_t k,
+                       size_t removed, size_t inserted)
+{
+    size_t first1, first2;
+    size_t b1 = li_block_of_row(li, r1, &first1);
+    size_t b2 = li_block_of_row(li, r2, &first2);
+    size_t start1 = fenwick_prefix(&li->bytes, b1);
+    size_t start2 = fenwick_prefix(&li->bytes, b2);
+    size_t i1 = r1 - first1;
+    size_t i2 = r2 - first2;
+    size_t delta = inserted - removed;
+    li->row_count = li->row_count + k - (r2 - r1 + 1);
+    li->version++;
+
+    // An edit that pushes the last home of the block out of reach has its
+    // lines cut into blocks again. Homes may wrap around on their way,
+    // as long as they end up in reach.
+    Line_Block *last = &li->blocks.data[b2];
+    size_t top = (i2 + 1 < last->homes.size)
+        ? start2 + last->homes.data[last->homes.size - 1] + delta - start1
+        : homes[k - 1] - start1;
+    if (top > LI_HOME_MAX) {
+        size_t after = last->homes.size - (i2 + 1);
+        size_t *all = malloc((i1 + k + after) * sizeof(*all));
+        assert(all != NULL);
+        for (size_t i = 0; i < i1; i++) {
+            all[i] = start1 + li->blocks.data[b1].homes.data[i];
+        }
+        memcpy(all + i1, homes, k * sizeof(*homes));
+        for (size_t i = 0; i < after; i++) {
+            all[i1 + k + i] = start2 + last->homes.data[i2 + 1 + i] + delta;
+        }
+        li_recut(li, b1, b2, all, i1 + k + after, start2 + last->bytes + delta);
+        free(all);
+        li_rebuild_trees(li);
+        return;
+    }
+
+    Line_Block *block = &li->blocks.data[b1];
+    size_t old = r2 - r1 + 1;
+
+    if (b1 != b2) {
+        // Pull the rest of b2 into b1 and drop the blocks in between; the
+        // generic path below then treats it as a single block edit
+        size_t shift = start2 - start1;
+
+        block->homes.size = i1 + 1;
+        da_append_n(&block->homes, &last->homes.data[i2], last->homes.size - i2);
+        for (size_t i = i1 + 1; i < block->homes.size; i++) {
+            block->homes.data[i] += shift;
+        }
+        for (size_t b = b1 + 1; b <= b2; b++) {
+            block->bytes += li->blocks.data[b].bytes;
+            da_clear(&li->blocks.data[b].homes);
+        }
+        da_remove_n_from(&li->blocks, b2 - b1, b1 + 1);
+        block = &li->blocks.data[b1];
+        i2 = i1 + 1;
+        old = 2;
+    } else {
+        i2 = i2 + 1;
+    }
+
+    // Lines [i1, i2) of the block are replaced, the room made for new ones
+    // is filled in below
+    if (k < old) {
+        da_remove_n_from(&block->homes, old - k, i1 + k);
+    } else if (k > old) {
+        da_insert_n(&block->homes, &homes[old], k - old, i2);
+    }
+    for (size_t i = 0; i < k; i++) {
+        block->homes.data[i1 + i] = homes[i] - start1;
+    }
+    for (size_t i = i1 + k; i < block->homes.size; i++) {
+        block->homes.data[i] += delta;
+    }
+    block->bytes += delta;
+
+    bool relayout = li_rebalance(li, b1) || b1 != b2;
+    if (relayout) {
+        li_rebuild_trees(li);
+    } else {
+        fenwick_add(&li->bytes, b1, delta);
+        fenwick_add(&li->rows, b1, k - old);
+    }
+}
+
+void li_insert(Line_Index *li, const char *s, size_t n, size_t at)
+{
+    if (n == 0) return;
+
+    size_t row = li_row_of(li, at);
+    size_t k = 1 + scan_count_newlines(s, n);
+
+    size_t single;
+    size_t *homes = (k == 1) ? &single : malloc(k * sizeof(*homes));
+    assert(homes != NULL);
+
+    size_t j = 0;
+    homes[j++] = li_line(li, row).home;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\n') homes[j++] = at + i + 1;
+    }
+
+    li_replace(li, row, row, homes, k, 0, n);
+    if (homes != &single) free(homes);
+}
+
+void li_delete(Line_Index *li, size_t n, size_t from)
+{
+    if (n == 0) return;
+
+    size_t r1 = li_row_of(li, from);
+    size_t r2 = li_row_of(li, from + n);
+    size_t home = li_line(li, r1).home;
+    li_replace(li, r1, r2, &home, 1, n, 0);
+}
@@ -0,0 +1,136 @@
+#define _DEFAULT_SOURCE
+
+#include "ds/page_cache.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static size_t pc_default_budget(void)
+{
+    const char *env = getenv("MEDO_PAGE_BUDGET");
+    long mib = (env != NULL) ? atol(env) : 0;
+    return (mib > 0) ? (size_t) mib * 1024 * 1024 : PC_BUDGET;
+}
+
+void pc_init(Page_Cache *pc, int fd, size_t size)
+{
+    *pc = (Page_Cache) {0};
+    pc->fd = fd;
+    pc->size = size;
+    pc->budget = pc_default_budget();
+
+    size_t zero = 0;
+    for (size_t i = 0; i < pc_page_count(pc); i++) {
+        da_append(&pc->slot_of, &zero);
+    }
+}
+
+void pc_end(Page_Cache *pc)
+{
+    for (size_t i = 0; i < pc->slots.size; i++) {
+        free(pc->slots.data[i].data);
+    }
+    da_clear(&pc->slots);
+    da_clear(&pc->slot_of);
+    close(pc->fd);
+    pc->fd = -1;
+    pc->size = 0;
+}
+
+static size_t pc_slot_count(const Page_Cache *pc)
+{
+    size_t count = pc->budget / PC_PAGE_SIZE;
+    return (count > PC_MIN_SLOTS) ? count : PC_MIN_SLOTS;
+}
+
+void pc_set_budget(Page_Cache *pc, size_t bytes)
+{
+    pc->budget = (bytes > 0) ? bytes : pc_default_budget();
+
+    // Whatever no longer fits goes, used or not
+    while (pc->slots.size > pc_slot_count(pc)) {
+        Pc_Slot *slot = &pc->slots.data[--pc->slots.size];
+        pc->slot_of.data[slot->page] = 0;
+        free(slot->data);
+    }
+}
+
+size_t pc_page_count(const Page_Cache *pc)
+{
+    return (pc->size + PC_PAGE_SIZE - 1) / PC_PAGE_SIZE;
+}
+
+size_t pc_read(const Page_Cache *pc, size_t at, char *buf, size_t n)
+{
+    if (at >= pc->size) return 0;
+    if (n > pc->size - at) n = pc->size - at;
+
+    size_t done = 0;
+    while (done < n) {
+        ssize_t got = pread(pc->fd, buf + done, n - done, at + done);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            perror("pread");
+            exit(1);
+        }
+        // The file was truncated under the editor, what is gone reads as zeros
+        if (got == 0) {
+            memset(buf + done, 0, n - done);
+            break;
+        }
+        done += got;
+    }
+    return n;
+}
+
+// Reads the page into a free slot, or over the least recently used one
+static Pc_Slot *pc_load(Page_Cache *pc, size_t page)
+{
+    Pc_Slot *slot;
+    if (pc->slots.size < pc_slot_count(pc)) {
+        Pc_Slot fresh = { .data = malloc(PC_PAGE_SIZE) };
+        assert(fresh.data != NULL);
+        da_append(&pc->slots, &fresh);
+        slot = &pc->slots.data[pc->slots.size - 1];
+    } else {
+        slot = &pc->slots.data[0];
+        for (size_t i = 1; i < pc->slots.size; i++) {
+            if (pc->slots.data[i].used < slot->used) slot = &pc->slots.data[i];
+        }
+        pc->slot_of.data[slot->page] = 0;
+    }
+
+    slot->page = page;
+    pc_read(pc, page * PC_PAGE_SIZE, slot->data, PC_PAGE_SIZE);
+    pc->slot_of.data[page] = (slot - pc->slots.data) + 1;
+    pc->reads++;
+    return slot;
+}
+
+const char *pc_span(Page_Cache *pc, size_t at, size_t *n)
+{
+    if (at >= pc->size) {
+        *n = 0;
+        return NULL;
+    }
+    size_t page = at / PC_PAGE_SIZE;
+    size_t i = pc->slot_of.data[page];
+    Pc_Slot *slot = (i > 0) ? &pc->slots.data[i - 1] : pc_load(pc, page);
+    slot->used = ++pc->tick;
+
+    size_t home = page * PC_PAGE_SIZE;
+    size_t end = (pc->size - home < PC_PAGE_SIZE) ? pc->size : home + PC_PAGE_SIZE;
+    *n = end - at;
+    return slot->data + (at - home);
+}
+
+char pc_char_at(Page_Cache *pc, size_t at)
+{
+    assert(at < pc->size);
+    size_t n;
+    return *pc_span(pc, at, &n);
+}
@@ -0,0 +1,354 @@
+#define _DEFAULT_SOURCE
+
+#include "ds/piece_table.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static Pt_Buffer *pt_buffer_new(char *data, size_t size)
+{
+    Pt_Buffer *buffer = calloc(1, sizeof(*buffer));
+    assert(buffer != NULL);
+    atomic_init(&buffer->refs, 1);
+    buffer->data = data;
+    buffer->size = size;
+    buffer->capacity = size;
+    return buffer;
+}
+
+static Pt_Buffer *pt_buffer_retain(Pt_Buffer *buffer)
+{
+    if (buffer != NULL) atomic_fetch_add(&buffer->refs, 1);
+    return buffer;
+}
+
+static void pt_buffer_release(Pt_Buffer *buffer)
+{
+    if (buffer == NULL || atomic_fetch_sub(&buffer->refs, 1) > 1) return;
+    if (buffer->mapped) {
+        munmap(buffer->data, buffer->size);
+    } else {
+        free(buffer->data);
+    }
+    if (buffer->paged != NULL) {
+        pc_end(buffer->paged);
+        free(buffer->paged);
+    }
+    free(buffer);
+}
+
+// The add buffer is only written past the text of every copy, and moved
+// instead of reallocated while a copy may still be reading it
+static size_t pt_add_append(Piece_Table *pt, const char *s, size_t n)
+{
+    if (pt->add == NULL) pt->add = pt_buffer_new(NULL, 0);
+    Pt_Buffer *add = pt->add;
+    size_t start = add->size;
+    if (n == 0) return start;
+    if (start + n > add->capacity) {
+        size_t capacity = (add->capacity > 0) ? 2 * add->capacity : 4096;
+        while (capacity < start + n) capacity *= 2;
+        if (atomic_load(&add->refs) == 1) {
+            add->data = realloc(add->data, capacity);
+            assert(add->data != NULL);
+        } else {
+            Pt_Buffer *moved = pt_buffer_new(malloc(capacity), start);
+            assert(moved->data != NULL);
+            memcpy(moved->data, add->data, start);
+            pt_buffer_release(add);
+            pt->add = add = moved;
+        }
+        add->capacity = capacity;
+    }
+    memcpy(add->data + start, s, n);
+    add->size += n;
+    return start;
+}
+
+void pt_init(Piece_Table *pt, char *original, size_t size)
+{
+    pt->original = pt_buffer_new(original, size);
+    pt->size = size;
+    if (size > 0) {
+        Piece piece = { .add = false, .start = 0, .len = size };
+        da_append(&pt->pieces, &piece);
+    }
+}
+
+void pt_init_mapped(Piece_Table *pt, char *original, size_t size)
+{
+    pt_init(pt, original, size);
+    pt->original->mapped = true;
+}
+
+void pt_init_paged(Piece_Table *pt, Page_Cache *pc)
+{
+    pt_init(pt, NULL, pc->size);
+    pt->original->paged = pc;
+}
+
+void pt_detach(Piece_Table *pt, size_t readable)
+{
+    if (!pt_mapped(pt)) return;
+    size_t size = pt->original->size;
+    if (readable > size) readable = size;
+
+    // Copies still reading the mapping keep it
+    char *copy = malloc(size);
+    assert(size == 0 || copy != NULL);
+    memcpy(copy, pt->original->data, readable);
+    memset(copy + readable, 0, size - readable);
+
+    pt_buffer_release(pt->original);
+    pt->original = pt_buffer_new(copy, size);
+}
+
+void pt_clear(Piece_Table *pt)
+{
+    pt_buffer_release(pt->original);
+    pt_buffer_release(pt->add);
+    pt->original = NULL;
+    pt->add = NULL;
+    pt->pieces.size = 0;
+    pt->size = 0;
+}
+
+void pt_end(Piece_Table *pt)
+{
+    pt_clear(pt);
+    da_clear(&pt->pieces);
+}
+
+void pt_share(const Piece_Table *pt, Piece_Table *copy)
+{
+    *copy = (Piece_Table) {0};
+    copy->size = pt->size;
+    if (pt->pieces.size > 0) da_append_n(&copy->pieces, pt->pieces.data, pt->pieces.size);
+    copy->add = pt_buffer_retain(pt->add);
+
+    // Slots of a page cache are read over by every lookup
+    Page_Cache *pc = pt_paged(pt);
+    if (pc != NULL) {
+        int fd = dup(pc->fd);
+        if (fd < 0) {
+            perror("dup");
+            exit(1);
+        }
+        Page_Cache *own = malloc(sizeof(*own));
+        assert(own != NULL);
+        pc_init(own, fd, pc->size);
+        pc_set_budget(own, PC_MIN_SLOTS * PC_PAGE_SIZE);
+        copy->original = pt_buffer_new(NULL, pc->size);
+        copy->original->paged = own;
+    } else {
+        copy->original = pt_buffer_retain(pt->original);
+    }
+}
+
+size_t pt_original_size(const Piece_Table *pt)
+{
+    return (pt->original != NULL) ? pt->original->size : 0;
+}
+
+size_t pt_added(const Piece_Table *pt)
+{
+    return (pt->add != NULL) ? pt->add->size : 0;
+}
+
+bool pt_mapped(const Piece_Table *pt)
+{
+    return pt->original != NULL && pt->original->mapped;
+}
+
+Page_Cache *pt_paged(const Piece_Table *pt)
+{
+    return (pt->original != NULL) ? pt->original->paged : NULL;
+}
+
+// Index of the piece containing `at`, or pieces.size when `at` is the end of the text
+static size_t pt_find(const Piece_Table *pt, size_t at, size_t *home)
+{
+    size_t h = 0;
+    size_t i;
+    for (i = 0; i < pt->pieces.size; i++) {
+        if (at < h + pt->pieces.data[i].len) break;
+        h += pt->pieces.data[i].len;
+    }
+    *home = h;
+    return i;
+}
+
+static const char *pt_piece_data(const Piece_Table *pt, Piece piece)
+{
+    return (piece.add ? pt->add->data : pt->original->data) + piece.start;
+}
+
+char pt_char_at(const Piece_Table *pt, size_t at)
+{
+    assert(at < pt->size);
+    size_t home;
+    size_t i = pt_find(pt, at, &home);
+    Piece piece = pt->pieces.data[i];
+    if (!piece.add && pt_paged(pt) != NULL) return pc_char_at(pt_paged(pt), piece.start + (at - home));
+    return pt_piece_data(pt, piece)[at - home];
+}
+
+const char *pt_span(const Piece_Table *pt, size_t at, size_t *n)
+{
+    if (at >= pt->size) {
+        *n = 0;
+        return NULL;
+    }
+    size_t home;
+    size_t i = pt_find(pt, at, &home);
+    Piece piece = pt->pieces.data[i];
+    *n = piece.len - (at - home);
+    if (!piece.add && pt_paged(pt) != NULL) {
+        size_t len;
+        const char *s = pc_span(pt_paged(pt), piece.start + (at - home), &len);
+        if (*n > len) *n = len;
+        return s;
+    }
+    return pt_piece_data(pt, piece) + (at - home);
+}
+
+void pt_insert(Piece_Table *pt, const char *s, size_t n, size_t at)
+{
+    assert(at <= pt->size);
+    if (n == 0) return;
+
+    size_t start = pt_add_append(pt, s, n);
+    pt->size += n;
+
+    size_t home;
+    size_t i = pt_find(pt, at, &home);
+    Piece piece = { .add = true, .start = start, .len = n };
+
+    if (at == home) {
+        // Typing right after the previous insertion just grows its piece
+        if (i > 0) {
+            Piece *prev = &pt->pieces.data[i - 1];
+            if (prev->add && prev->start + prev->len == start) {
+                prev->len += n;
+                return;
+            }
+        }
+        da_insert(&pt->pieces, &piece, i);
+        return;
+    }
+
+    Piece *p = &pt->pieces.data[i];
+    Piece split[2] = {
+        piece,
+        { .add = p->add, .start = p->start + (at - home), .len = p->len - (at - home) },
+    };
+    p->len = at - home;
+    da_insert_n(&pt->pieces, split, 2, i + 1);
+}
+
+void pt_delete(Piece_Table *pt, size_t n, size_t from)
+{
+    assert(from + n <= pt->size);
+    if (n == 0) return;
+    pt->size -= n;
+
+    size_t home;
+    size_t i = pt_find(pt, from, &home);
+    size_t off = from - home;
+
+    if (off > 0) {
+        Piece *p = &pt->pieces.data[i];
+        if (off + n < p->len) {
+            Piece right = { .add = p->add, .start = p->start + off + n, .len = p->len - off - n };
+            p->len = off;
+            da_insert(&pt->pieces, &right, i + 1);
+            return;
+        }
+        n -= p->len - off;
+        p->len = off;
+        i++;
+    }
+
+    size_t first = i;
+    while (n > 0 && n >= pt->pieces.data[i].len) {
+        n -= pt->pieces.data[i].len;
+        i++;
+    }
+    if (n > 0) {
+        pt->pieces.data[i].start += n;
+        pt->pieces.data[i].len -= n;
+    }
+    if (i > first) {
+        da_remove_n_from(&pt->pieces, i - first, first);
+    }
+}
+
+// Appends a piece, merging it with the previous one when they are contiguous
+static void pt_push_piece(Pieces *pieces, Piece piece)
+{
+    if (piece.len == 0) return;
+    if (pieces->size > 0) {
+        Piece *last = &pieces->data[pieces->size - 1];
+        if (last->add == piece.add && last->start + last->len == piece.start) {
+            last->len += piece.len;
+            return;
+        }
+    }
+    da_append(pieces, &piece);
+}
+
+void pt_replace(Piece_Table *pt, const Range *ranges, size_t count, const char *s, size_t n)
+{
+    size_t start = pt_add_append(pt, s, n);
+
+    Pieces pieces = {0};
+    size_t i = 0;   // piece being walked
+    size_t off = 0; // bytes of it already passed
+    size_t at = 0;  // text offset of the walk
+    for (size_t r = 0; r <= count; r++) {
+        size_t until = (r < count) ? ranges[r].from : pt->size;
+        assert(at <= until && until <= pt->size);
+
+        // Keep the text up to the range
+        while (at < until) {
+            Piece p = pt->pieces.data[i];
+            size_t len = p.len - off;
+            if (len > until - at) len = until - at;
+            pt_push_piece(&pieces, (Piece) { .add = p.add, .start = p.start + off, .len = len });
+            at += len;
+            off += len;
+            if (off == p.len) {
+                i++;
+                off = 0;
+            }
+        }
+        if (r == count) break;
+
+        pt_push_piece(&pieces, (Piece) { .add = true, .start = start, .len = n });
+
+        // Skip the replaced text
+        size_t end = at + ranges[r].n;
+        assert(end <= pt->size);
+        while (at < end) {
+            size_t len = pt->pieces.data[i].len - off;
+            if (len > end - at) len = end - at;
+            at += len;
+            off += len;
+            if (off == pt->pieces.data[i].len) {
+                i++;
+                off = 0;
+            }
+        }
+    }
+
+    size_t removed = 0;
+    for (size_t r = 0; r < count; r++) removed += ranges[r].n;
+    pt->size = pt->size - removed + count * n;
+
+    da_clear(&pt->pieces);
+    pt->pieces = pieces;
+}
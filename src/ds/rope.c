@@ -0,0 +1,362 @@
+#include "ds/rope.h"
+#include "scan.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static Rope_Node *rope_node_new(bool leaf)
+{
+    Rope_Node *node = calloc(1, sizeof(*node));
+    assert(node != NULL);
+    atomic_init(&node->refs, 1);
+    node->leaf = leaf;
+    if (leaf) {
+        node->text = malloc(ROPE_LEAF_MAX);
+        assert(node->text != NULL);
+    }
+    return node;
+}
+
+static Rope_Node *rope_node_retain(Rope_Node *node)
+{
+    atomic_fetch_add(&node->refs, 1);
+    return node;
+}
+
+static void rope_node_release(Rope_Node *node)
+{
+    if (atomic_fetch_sub(&node->refs, 1) > 1) return;
+    if (node->leaf) {
+        free(node->text);
+    } else {
+        for (size_t i = 0; i < node->count; i++) {
+            rope_node_release(node->children[i]);
+        }
+    }
+    free(node);
+}
+
+// Makes the node in `slot` safe to modify. A node that is shared is replaced
+// by a copy of its own, which shares the children in turn.
+static Rope_Node *rope_node_own(Rope_Node **slot)
+{
+    Rope_Node *node = *slot;
+    if (atomic_load(&node->refs) == 1) return node;
+
+    Rope_Node *copy = rope_node_new(node->leaf);
+    copy->bytes = node->bytes;
+    copy->newlines = node->newlines;
+    copy->count = node->count;
+    if (node->leaf) {
+        memcpy(copy->text, node->text, node->count);
+    } else {
+        for (size_t i = 0; i < node->count; i++) {
+            copy->children[i] = rope_node_retain(node->children[i]);
+        }
+    }
+    rope_node_release(node);
+    *slot = copy;
+    return copy;
+}
+
+static void rope_leaf_set(Rope_Node *leaf, const char *s, size_t n)
+{
+    assert(n <= ROPE_LEAF_MAX);
+    memcpy(leaf->text, s, n);
+    leaf->count = n;
+    leaf->bytes = n;
+    leaf->newlines = scan_count_newlines(s, n);
+}
+
+static void rope_branch_update(Rope_Node *branch)
+{
+    branch->bytes = 0;
+    branch->newlines = 0;
+    for (size_t i = 0; i < branch->count; i++) {
+        branch->bytes += branch->children[i]->bytes;
+        branch->newlines += branch->children[i]->newlines;
+    }
+}
+
+static void rope_branch_set(Rope_Node *branch, Rope_Node **children, size_t n)
+{
+    assert(n <= ROPE_BRANCH_MAX);
+    memcpy(branch->children, children, n * sizeof(*children));
+    branch->count = n;
+    rope_branch_update(branch);
+}
+
+void rope_clear(Rope *rope)
+{
+    if (rope->root != NULL) rope_node_release(rope->root);
+    rope->root = rope_node_new(true);
+}
+
+void rope_end(Rope *rope)
+{
+    if (rope->root != NULL) rope_node_release(rope->root);
+    rope->root = NULL;
+}
+
+Rope rope_share(const Rope *rope)
+{
+    return (Rope) { (rope->root != NULL) ? rope_node_retain(rope->root) : NULL };
+}
+
+size_t rope_size(const Rope *rope)
+{
+    return (rope->root != NULL) ? rope->root->bytes : 0;
+}
+
+size_t rope_newlines(const Rope *rope)
+{
+    return (rope->root != NULL) ? rope->root->newlines : 0;
+}
+
+// Access
+
+const char *rope_span(const Rope *rope, size_t at, size_t *n)
+{
+    if (at >= rope_size(rope)) {
+        *n = 0;
+        return NULL;
+    }
+
+    const Rope_Node *node = rope->root;
+    while (!node->leaf) {
+        size_t i = 0;
+        while (at >= node->children[i]->bytes) {
+            at -= node->children[i]->bytes;
+            i++;
+        }
+        node = node->children[i];
+    }
+    *n = node->count - at;
+    return node->text + at;
+}
+
+char rope_char_at(const Rope *rope, size_t at)
+{
+    assert(at < rope_size(rope));
+    size_t n;
+    return *rope_span(rope, at, &n);
+}
+
+size_t rope_row_of(const Rope *rope, size_t at)
+{
+    assert(at <= rope_size(rope));
+    if (rope->root == NULL) return 0;
+
+    size_t row = 0;
+    const Rope_Node *node = rope->root;
+    while (!node->leaf) {
+        size_t i = 0;
+        while (i + 1 < node->count && at >= node->children[i]->bytes) {
+            at -= node->children[i]->bytes;
+            row += node->children[i]->newlines;
+            i++;
+        }
+        node = node->children[i];
+    }
+    return row + scan_count_newlines(node->text, at);
+}
+
+size_t rope_row_home(const Rope *rope, size_t row)
+{
+    assert(row <= rope_newlines(rope));
+    if (row == 0) return 0;
+
+    // Find the newline that ends the previous row
+    size_t k = row - 1;
+    size_t home = 0;
+    const Rope_Node *node = rope->root;
+    while (!node->leaf) {
+        size_t i = 0;
+        while (k >= node->children[i]->newlines) {
+            k -= node->children[i]->newlines;
+            home += node->children[i]->bytes;
+            i++;
+        }
+        node = node->children[i];
+    }
+    for (size_t i = 0; i < node->count; i++) {
+        if (node->text[i] == '\n') {
+            if (k == 0) return home + i + 1;
+            k--;
+        }
+    }
+    assert(0 && "unreachable");
+    return home;
+}
+
+// Manipulation
+
+// Inserts at most ROPE_LEAF_MAX bytes into the subtree. Returns the new
+// right sibling if the node had to be split, NULL otherwise. Appending to
+// the end of a node leaves it full instead of splitting it in half, so text
+// loaded front to back is packed densely.
+static Rope_Node *rope_node_insert(Rope_Node *node, const char *s, size_t n, size_t at)
+{
+    if (node->leaf) {
+        if (node->count + n <= ROPE_LEAF_MAX) {
+            memmove(node->text + at + n, node->text + at, node->count - at);
+            memcpy(node->text + at, s, n);
+            node->count += n;
+            node->bytes = node->count;
+            node->newlines += scan_count_newlines(s, n);
+            return NULL;
+        }
+
+        char buf[2 * ROPE_LEAF_MAX];
+        size_t total = node->count + n;
+        memcpy(buf, node->text, at);
+        memcpy(buf + at, s, n);
+        memcpy(buf + at + n, node->text + at, node->count - at);
+
+        size_t left = (at == node->count) ? ROPE_LEAF_MAX : total / 2;
+        Rope_Node *right = rope_node_new(true);
+        rope_leaf_set(node, buf, left);
+        rope_leaf_set(right, buf + left, total - left);
+        return right;
+    }
+
+    size_t i = 0;
+    while (i + 1 < node->count && at > node->children[i]->bytes) {
+        at -= node->children[i]->bytes;
+        i++;
+    }
+
+    Rope_Node *split = rope_node_insert(rope_node_own(&node->children[i]), s, n, at);
+    if (split == NULL) {
+        node->bytes += n;
+        node->newlines += scan_count_newlines(s, n);
+        return NULL;
+    }
+
+    Rope_Node *children[ROPE_BRANCH_MAX + 1];
+    size_t count = node->count;
+    memcpy(children, node->children, (i + 1) * sizeof(*children));
+    children[i + 1] = split;
+    memcpy(children + i + 2, node->children + i + 1, (count - i - 1) * sizeof(*children));
+    count++;
+
+    if (count <= ROPE_BRANCH_MAX) {
+        rope_branch_set(node, children, count);
+        return NULL;
+    }
+
+    size_t left = (i + 2 == count) ? ROPE_BRANCH_MAX : count / 2;
+    Rope_Node *right = rope_node_new(false);
+    rope_branch_set(node, children, left);
+    rope_branch_set(right, children + left, count - left);
+    return right;
+}
+
+void rope_insert(Rope *rope, const char *s, size_t n, size_t at)
+{
+    assert(at <= rope_size(rope));
+    if (rope->root == NULL) rope_clear(rope);
+
+    while (n > 0) {
+        size_t k = (n < ROPE_LEAF_MAX) ? n : ROPE_LEAF_MAX;
+        Rope_Node *split = rope_node_insert(rope_node_own(&rope->root), s, k, at);
+        if (split != NULL) {
+            Rope_Node *children[2] = { rope->root, split };
+            rope->root = rope_node_new(false);
+            rope_branch_set(rope->root, children, 2);
+        }
+        s += k;
+        at += k;
+        n -= k;
+    }
+}
+
+// Merges neighbouring children that fit into a single node so that
+// deletions do not leave the tree full of tiny nodes
+static void rope_branch_compact(Rope_Node *branch)
+{
+    size_t i = 0;
+    while (i + 1 < branch->count) {
+        Rope_Node *a = branch->children[i];
+        Rope_Node *b = branch->children[i + 1];
+        size_t max = a->leaf ? ROPE_LEAF_MAX : ROPE_BRANCH_MAX;
+        if (a->count + b->count > max) {
+            i++;
+            continue;
+        }
+
+        // The children of b are taken over, and stay with b too if it is shared
+        a = rope_node_own(&branch->children[i]);
+        if (a->leaf) {
+            memcpy(a->text + a->count, b->text, b->count);
+        } else {
+            for (size_t j = 0; j < b->count; j++) {
+                a->children[a->count + j] = rope_node_retain(b->children[j]);
+            }
+        }
+        a->count += b->count;
+        a->bytes += b->bytes;
+        a->newlines += b->newlines;
+        rope_node_release(b);
+
+        memmove(branch->children + i + 1, branch->children + i + 2,
+                (branch->count - i - 2) * sizeof(*branch->children));
+        branch->count--;
+    }
+}
+
+static void rope_node_delete(Rope_Node *node, size_t n, size_t from)
+{
+    if (node->leaf) {
+        node->newlines -= scan_count_newlines(node->text + from, n);
+        memmove(node->text + from, node->text + from + n, node->count - from - n);
+        node->count -= n;
+        node->bytes = node->count;
+        return;
+    }
+
+    size_t home = 0;
+    size_t i = 0;
+    while (i < node->count && n > 0) {
+        Rope_Node *child = node->children[i];
+        if (from >= home + child->bytes) {
+            home += child->bytes;
+            i++;
+            continue;
+        }
+
+        size_t off = from - home;
+        size_t k = (n < child->bytes - off) ? n : child->bytes - off;
+        n -= k;
+        if (off == 0 && k == child->bytes) {
+            rope_node_release(child);
+            memmove(node->children + i, node->children + i + 1,
+                    (node->count - i - 1) * sizeof(*node->children));
+            node->count--;
+            continue;
+        }
+
+        child = rope_node_own(&node->children[i]);
+        rope_node_delete(child, k, off);
+        home += child->bytes;
+        i++;
+    }
+
+    rope_branch_compact(node);
+    rope_branch_update(node);
+}
+
+void rope_delete(Rope *rope, size_t n, size_t from)
+{
+    assert(from + n <= rope_size(rope));
+    if (n == 0) return;
+
+    rope_node_delete(rope_node_own(&rope->root), n, from);
+
+    while (!rope->root->leaf && rope->root->count <= 1) {
+        Rope_Node *root = rope->root;
+        rope->root = (root->count == 1) ? rope_node_retain(root->children[0]) : rope_node_new(true);
+        rope_node_release(root);
+    }
+}
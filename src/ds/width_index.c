@@ -0,0 +1,264 @@
+#include "ds/width_index.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+void wi_clear(Width_Index *wi)
+{
+    wi->blocks.size = 0;
+    wi->bytes.size = 0;
+    wi->tree.size = 0;
+    wi->leaves = 0;
+    wi->size = 0;
+}
+
+void wi_end(Width_Index *wi)
+{
+    da_clear(&wi->blocks);
+    da_clear(&wi->bytes);
+    da_clear(&wi->tree);
+    wi->leaves = 0;
+    wi->size = 0;
+}
+
+static float wi_max(float a, float b)
+{
+    return (a > b) ? a : b;
+}
+
+static Wi_Block wi_join(Wi_Block a, Wi_Block b)
+{
+    Wi_Block joined = { a.bytes + b.bytes, a.head, a.widest, b.tail, a.newline || b.newline };
+    if (!a.newline) {
+        joined.head = a.head + b.head;
+        joined.widest = b.widest;
+        if (!b.newline) joined.tail = joined.head;
+    } else if (!b.newline) {
+        joined.tail = a.tail + b.head;
+    } else {
+        joined.widest = wi_max(wi_max(a.widest, b.widest), a.tail + b.head);
+    }
+    return joined;
+}
+
+// Measuring
+
+static float wi_width(const Width_Index *wi, const char *s, size_t n)
+{
+    // Four sums, so that the additions do not wait for each other
+    float sums[4] = {0};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        sums[0] += wi->advance[(unsigned char) s[i]];
+        sums[1] += wi->advance[(unsigned char) s[i + 1]];
+        sums[2] += wi->advance[(unsigned char) s[i + 2]];
+        sums[3] += wi->advance[(unsigned char) s[i + 3]];
+    }
+    for (; i < n; i++) {
+        sums[0] += wi->advance[(unsigned char) s[i]];
+    }
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+static Wi_Block wi_measure_s(const Width_Index *wi, const char *s, size_t n)
+{
+    Wi_Block block = { .bytes = n };
+    const char *end = s + n;
+    const char *newline = memchr(s, '\n', n);
+    if (newline == NULL) {
+        block.head = block.tail = wi_width(wi, s, n);
+        return block;
+    }
+
+    block.newline = true;
+    block.head = wi_width(wi, s, newline - s);
+    for (;;) {
+        s = newline + 1;
+        newline = memchr(s, '\n', end - s);
+        if (newline == NULL) break;
+        block.widest = wi_max(block.widest, wi_width(wi, s, newline - s));
+    }
+    block.tail = wi_width(wi, s, end - s);
+    return block;
+}
+
+static Wi_Block wi_measure(const Width_Index *wi, const void *text, Ci_Span span, size_t from, size_t n)
+{
+    assert(wi->advance != NULL);
+    Wi_Block block = {0};
+    while (n > 0) {
+        size_t len;
+        const char *s = span(text, from, &len);
+        assert(len > 0);
+        if (len > n) len = n;
+        block = wi_join(block, wi_measure_s(wi, s, len));
+        from += len;
+        n -= len;
+    }
+    return block;
+}
+
+// Trees
+
+static void wi_rebuild_trees(Width_Index *wi)
+{
+    size_t n = wi->blocks.size + 1;
+    size_t zero = 0;
+    wi->bytes.size = 0;
+    for (size_t i = 0; i < n; i++) {
+        da_append(&wi->bytes, &zero);
+    }
+    for (size_t i = 1; i < n; i++) {
+        wi->bytes.data[i] += wi->blocks.data[i - 1].bytes;
+        size_t parent = i + (i & -i);
+        if (parent < n) wi->bytes.data[parent] += wi->bytes.data[i];
+    }
+
+    wi->leaves = 1;
+    while (wi->leaves < wi->blocks.size) wi->leaves *= 2;
+    Wi_Block empty = {0};
+    wi->tree.size = 0;
+    for (size_t i = 0; i < 2 * wi->leaves; i++) {
+        da_append(&wi->tree, &empty);
+    }
+    for (size_t b = 0; b < wi->blocks.size; b++) {
+        wi->tree.data[wi->leaves + b] = wi->blocks.data[b];
+    }
+    for (size_t i = wi->leaves - 1; i > 0; i--) {
+        wi->tree.data[i] = wi_join(wi->tree.data[2 * i], wi->tree.data[2 * i + 1]);
+    }
+}
+
+// Joins the path of block b up to the root again
+static void wi_tree_set(Width_Index *wi, size_t b)
+{
+    size_t i = wi->leaves + b;
+    wi->tree.data[i] = wi->blocks.data[b];
+    for (i /= 2; i > 0; i /= 2) {
+        wi->tree.data[i] = wi_join(wi->tree.data[2 * i], wi->tree.data[2 * i + 1]);
+    }
+}
+
+static void wi_push(Width_Index *wi, Wi_Block block)
+{
+    da_append(&wi->blocks, &block);
+    wi->size += block.bytes;
+    if (wi->blocks.size > wi->leaves) {
+        wi_rebuild_trees(wi);
+        return;
+    }
+    fenwick_push(&wi->bytes, block.bytes);
+    wi_tree_set(wi, wi->blocks.size - 1);
+}
+
+// Building
+
+void wi_append(Width_Index *wi, const void *text, Ci_Span span, size_t n)
+{
+    size_t b = wi->blocks.size - 1;
+    if (wi->blocks.size > 0 && wi->blocks.data[b].bytes < WI_BLOCK_MAX && n > 0) {
+        Wi_Block *last = &wi->blocks.data[b];
+        size_t m = WI_BLOCK_MAX - last->bytes;
+        if (m > n) m = n;
+        *last = wi_join(*last, wi_measure(wi, text, span, wi->size, m));
+        fenwick_add(&wi->bytes, b, m);
+        wi_tree_set(wi, b);
+        wi->size += m;
+        n -= m;
+    }
+    while (n > 0) {
+        size_t m = (n < WI_BLOCK_MAX) ? n : WI_BLOCK_MAX;
+        wi_push(wi, wi_measure(wi, text, span, wi->size, m));
+        n -= m;
+    }
+}
+
+// Queries
+
+size_t wi_size(const Width_Index *wi)
+{
+    return wi->size;
+}
+
+float wi_widest(const Width_Index *wi)
+{
+    if (wi->blocks.size == 0) return 0;
+    const Wi_Block *root = &wi->tree.data[1];
+    return wi_max(wi_max(root->head, root->widest), root->tail);
+}
+
+// Block containing `at`, the last one for the end of the text
+static size_t wi_block_of_offset(const Width_Index *wi, size_t at, size_t *start)
+{
+    size_t b = fenwick_search(&wi->bytes, at, start);
+    if (b >= wi->blocks.size) {
+        b = wi->blocks.size - 1;
+        *start = fenwick_prefix(&wi->bytes, b);
+    }
+    return b;
+}
+
+// Updating
+
+// Forgets the widths from `at` on
+static void wi_truncate(Width_Index *wi, const void *text, Ci_Span span, size_t at)
+{
+    if (at >= wi->size) return;
+    size_t start;
+    size_t b = wi_block_of_offset(wi, at, &start);
+    wi->blocks.size = b;
+    if (at > start) {
+        Wi_Block block = wi_measure(wi, text, span, start, at - start);
+        da_append(&wi->blocks, &block);
+    }
+    wi->size = at;
+    wi_rebuild_trees(wi);
+}
+
+void wi_update(Width_Index *wi, const void *text, Ci_Span span, size_t from, size_t removed, size_t inserted)
+{
+    if (removed == 0 && inserted == 0) return;
+    if (from > wi->size) return;
+    if (from + removed > wi->size || wi->blocks.size == 0) {
+        wi_truncate(wi, text, span, from);
+        wi_append(wi, text, span, inserted);
+        return;
+    }
+
+    size_t start, last_start;
+    size_t b1 = wi_block_of_offset(wi, from, &start);
+    size_t b2 = (removed > 0) ? wi_block_of_offset(wi, from + removed - 1, &last_start) : b1;
+    size_t end = fenwick_prefix(&wi->bytes, b2 + 1);
+    size_t bytes = end - start - removed + inserted;
+    wi->size += inserted - removed;
+
+    // An edit within a block measures the block again. Blocks are let grow
+    // up to twice their size, so that typing into full ones seldom cuts them.
+    if (b1 == b2 && bytes > 0 && bytes <= 2 * WI_BLOCK_MAX) {
+        Wi_Block *block = &wi->blocks.data[b1];
+        fenwick_add(&wi->bytes, b1, bytes - block->bytes);
+        *block = wi_measure(wi, text, span, start, bytes);
+        wi_tree_set(wi, b1);
+        return;
+    }
+
+    // Otherwise the blocks are cut again, into even parts so that the next
+    // edits find room in them
+    size_t count = (bytes + WI_BLOCK_MAX - 1) / WI_BLOCK_MAX;
+    da_remove_n_from(&wi->blocks, b2 - b1 + 1, b1);
+    if (count > 0) {
+        Wi_Block *parts = malloc(count * sizeof(*parts));
+        assert(parts != NULL);
+        size_t at = start;
+        for (size_t j = 0; j < count; j++) {
+            size_t m = bytes / count + (j < bytes % count);
+            parts[j] = wi_measure(wi, text, span, at, m);
+            at += m;
+        }
+        da_insert_n(&wi->blocks, parts, count, b1);
+        free(parts);
+    }
+    wi_rebuild_trees(wi);
+}
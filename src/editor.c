@@ -7,6 +7,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,6 +18,10 @@
 #define SV_IMPLEMENTATION
 #include "sv.h"
 
+#define GAP_BUFFER_MAX_SIZE  (64 * 1024 * 1024)
+#define PIECE_TABLE_MAX_SIZE (1024 * 1024 * 1024)
+#define MAPPED_MAX_SIZE      ((size_t) 4 * 1024 * 1024 * 1024)
+
 #define sv_c_str(c_chunk, sv_chunk)                     \
     c_chunk = malloc(sv_chunk.count + 1);               \
     memcpy(c_chunk, sv_chunk.data, sv_chunk.count);     \
@@ -24,7 +29,7 @@
 
 // File I/O
 static void save_file(const Editor *e);
-static void open_file(Editor *e, const char *filename);
+static void open_file(Editor *e, const char *filename, size_t size);
 static void open_dir(Editor *e, const char *dirname);
 
 // Editor Operations
@@ -38,6 +43,15 @@ static void update_pathname(Editor *e, String_View path);
 
 static size_t editor_selection_delete(Editor *e);
 
+// Multiple cursors
+static void editor_cursors_normalize(Editor *e);
+static size_t editor_edit_cursors(Editor *e, const char *s, size_t before, size_t after);
+static bool editor_edit_key_cursors(Editor *e, EditorKey key);
+static void editor_move_cursors(Editor *e, EditorKey key, bool leave_selection);
+static void editor_select_cursors(Editor *e, EditorKey key);
+static void editor_add_cursor(Editor *e, EditorKey key);
+static void editor_add_cursor_at_next_match(Editor *e);
+
 // Search operations
 static void editor_search_start(Editor *e);
 static int editor_search_next(Editor *e, size_t cur);
@@ -68,11 +82,11 @@ Editor editor_init(void)
 void editor_clear(Editor *e)
 {
     e->mode = EM_EDITING;
-    e->be.cur = 0;
-    e->be.data.size = 0;
+    e->cursors.size = 0;
+    be_clear(&e->be);
 }
 
-static_assert(sizeof(Editor) == 176, "Editor structure has changed");
+static_assert(sizeof(Editor) == 1032, "Editor structure has changed");
 
 void editor_process_key(Editor *e, EditorKey key)
 {
@@ -101,10 +115,12 @@ void editor_process_key(Editor *e, EditorKey key)
                         {
                             e->be.cur = e->select_cur;
                         }
+                        editor_move_cursors(e, key, true);
                         return;
                     }
 
                     e->be.cur = editor_move(e, key, e->be.cur);
+                    editor_move_cursors(e, key, false);
                 } break;
 
                 case EK_BACKSPACE:
@@ -118,6 +134,7 @@ void editor_process_key(Editor *e, EditorKey key)
                 case EK_RETURN: // Return effect defaults to BREAK_LINE
                 case EK_BREAK_LINE:
                 case EK_TAB: {
+                    if (editor_edit_key_cursors(e, key)) break;
                     if (e->mode == EM_SELECTION) {
                         e->be.cur = editor_selection_delete(e);
                         e->mode = EM_EDITING;
@@ -135,10 +152,21 @@ void editor_process_key(Editor *e, EditorKey key)
                 case EK_COPY:
                 case EK_PASTE: 
                 case EK_CUT: 
+                case EK_UNDO:
+                case EK_REDO:
                 case EK_SEARCH_START: {
                     editor_action(e, key);
                 } break;
 
+                case EK_CURSOR_ABOVE:
+                case EK_CURSOR_BELOW: {
+                    editor_add_cursor(e, key);
+                } break;
+
+                case EK_CURSOR_NEXT_MATCH: {
+                    editor_add_cursor_at_next_match(e);
+                } break;
+
                 case EK_SELECT_LEFT:
                 case EK_SELECT_RIGHT:
                 case EK_SELECT_UP:
@@ -156,11 +184,13 @@ void editor_process_key(Editor *e, EditorKey key)
                 case EK_SELECT_NEXT_PARAGRAPH:
                 case EK_SELECT_PREV_PARAGRAPH:
                 case EK_SELECT_ALL: {
+                    editor_select_cursors(e, key);
                     e->be.cur = editor_select(e, key, e->be.cur);
                 } break;
 
                 case EK_ESC: {
                     e->mode = EM_EDITING;
+                    e->cursors.size = 0;
                 } break;
 
                 default:
@@ -235,7 +265,7 @@ void editor_process_key(Editor *e, EditorKey key)
     }
 }
 
-static_assert(EK_COUNT == 52, "The number of editor keys has changed");
+static_assert(EK_COUNT == 57, "The number of editor keys has changed");
 
 size_t editor_write_at(Editor *e, const char *s, size_t at)
 {
@@ -254,9 +284,17 @@ size_t editor_write_at(Editor *e, const char *s, size_t at)
         return at;
     }
 
+    if (e->cursors.size > 0) {
+        return editor_edit_cursors(e, s, 0, 0);
+    }
+
     if (e->mode == EM_SELECTION) {
+        be_begin(&e->be);
         e->be.cur = editor_selection_delete(e);
         e->mode = EM_EDITING;
+        at = be_insert_sn(&e->be, s, strlen(s));
+        be_commit(&e->be);
+        return at;
     }
 
     at = be_insert_sn(&e->be, s, strlen(s));
@@ -267,6 +305,10 @@ size_t editor_write_at(Editor *e, const char *s, size_t at)
 
 static size_t editor_selection_delete(Editor *e)
 {
+    if (e->cursors.size > 0) {
+        return editor_edit_cursors(e, "", 0, 0);
+    }
+
     size_t begin = e->select_cur;
     size_t end = e->be.cur;
     if (begin > end) {
@@ -295,20 +337,20 @@ static void editor_selection_copy(Editor *e)
     size_t n = end - begin;
 
     e->clipboard = malloc(n + 1);
-    strncpy(e->clipboard, e->be.data.data + begin, n);
+    be_copy_n(&e->be, e->clipboard, begin, n);
     e->clipboard[n] = '\0';
 }
 
 size_t editor_move(Editor *e, EditorKey key, size_t cur)
 {
-#define issymbol(c) (isalnum(c) || c == '_')
+    be_undo_seal(&e->be); // typing somewhere else is a new step
     switch (key) {
         case EK_LEFT: {
-            if (cur > 0) cur--;
+            cur = be_move_left(&e->be, cur);
         } break;
 
         case EK_RIGHT: {
-            if (cur < e->be.data.size) cur++;
+            cur = be_move_right(&e->be, cur);
         } break;
 
         case EK_UP: {
@@ -340,7 +382,8 @@ size_t editor_move(Editor *e, EditorKey key, size_t cur)
         } break;
 
         case EK_END: {
-            cur = e->be.data.size;
+            be_index_wait(&e->be);
+            cur = be_size(&e->be);
         } break;
 
         case EK_NEXT_PARAGRAPH: {
@@ -355,8 +398,9 @@ size_t editor_move(Editor *e, EditorKey key, size_t cur)
             assert(0);
     }
 
+    // Motions stop at the end of what has been indexed so far
+    if (cur > be_indexed_size(&e->be)) cur = be_indexed_size(&e->be);
     return cur;
-#undef issymbol
 }
 
 size_t editor_edit(Editor *e, EditorKey key, size_t cur)
@@ -386,11 +430,13 @@ size_t editor_edit(Editor *e, EditorKey key, size_t cur)
 
         case EK_TAB: {
             Line line = be_get_line(&e->be, e->be.cur);
-            size_t col = e->be.cur - line.home;
+            size_t col = be_col_of(&e->be, line, e->be.cur);
             size_t tabstop = 4 - (col % 4);
+            be_begin(&e->be);
             for (size_t i = 0; i < tabstop; i++) {
                 e->be.cur = editor_write_at(e, " ", e->be.cur);
             }
+            be_commit(&e->be);
         } break;
 
         case EK_INDENT: {
@@ -443,12 +489,23 @@ static void editor_action(Editor *e, EditorKey key)
         } break;
 
         case EK_PASTE: {
+            be_begin(&e->be);
             e->be.cur = editor_write_at(e, e->clipboard, e->be.cur);
+            be_commit(&e->be);
         } break;
 
         case EK_CUT: {
             editor_selection_copy(e);
+            be_begin(&e->be);
             e->be.cur = editor_selection_delete(e);
+            be_commit(&e->be);
+        } break;
+
+        case EK_UNDO:
+        case EK_REDO: {
+            e->cursors.size = 0;
+            bool done = (key == EK_UNDO) ? be_undo(&e->be) : be_redo(&e->be);
+            if (done) e->mode = EM_EDITING;
         } break;
 
         default:
@@ -471,8 +528,11 @@ static void editor_browsing(Editor *e, EditorKey key)
 
         case EK_RETURN: {
             Line line = be_get_line(&e->be, e->be.cur);
-            String_View path = sv_from_parts(&e->be.data.data[line.home], line.end - line.home);
-            editor_open(e, path);
+            size_t n = line.end - line.home;
+            char *name = malloc(n);
+            be_copy_n(&e->be, name, line.home, n);
+            editor_open(e, sv_from_parts(name, n));
+            free(name);
         } break;
 
         case EK_HOME: {
@@ -480,7 +540,7 @@ static void editor_browsing(Editor *e, EditorKey key)
         } break;
 
         case EK_END: {
-            Line line = be_get_line(&e->be, e->be.data.size);
+            Line line = be_get_line(&e->be, be_size(&e->be));
             e->be.cur = line.home;
         } break;    
 
@@ -540,71 +600,26 @@ static size_t editor_select(Editor *e, EditorKey key, size_t cur)
         } break;
 
         case EK_SELECT_OUTER_BLOCK: {
-            size_t start_cur = e->select_cur;
-            
-            size_t stack_count = 0;
-            while (start_cur > 0) {
-                start_cur = editor_move(e, EK_LEFT, start_cur);
-                if (strchr("{[(", e->be.data.data[start_cur]) != NULL) {
-                    if (stack_count == 0) break;
-                    stack_count--;
-                }
-                if (strchr("}])", e->be.data.data[start_cur]) != NULL) {
-                    stack_count++;
-                }
-            }
-
-            if (stack_count != 0) {
+            size_t from = (e->select_cur < cur) ? e->select_cur : cur;
+            size_t to = (e->select_cur < cur) ? cur : e->select_cur;
+            Range block;
+            if (!be_outer_block(&e->be, from, to, &block)) {
                 e->mode = EM_EDITING;
                 return cur;
             }
+            e->select_cur = block.from;
+            cur = block.from + block.n;
+        } break;
 
-            size_t end_cur = cur;
-            while (end_cur < e->be.data.size) {
-                end_cur = editor_move(e, EK_RIGHT, end_cur);
-                if (strchr("}])", e->be.data.data[end_cur]) != NULL) {
-                    if (stack_count == 0) break;
-                    stack_count--;
-                }
-                if (strchr("{[(", e->be.data.data[end_cur]) != NULL) {
-                    stack_count++;
-                }
-            }
-
-            if (stack_count != 0) {
+        case EK_SELECT_NEXT_BLOCK: {
+            Range block;
+            if (!be_next_block(&e->be, cur, &block)) {
                 e->mode = EM_EDITING;
                 return cur;
             }
-
-            end_cur = editor_move(e, EK_RIGHT, end_cur);
-            e->select_cur = start_cur;
-            cur = end_cur;
-        } break;
-
-        // case EK_SELECT_NEXT_BLOCK: {
-        //     const char *s = editor_get_line(e);
-        //     size_t slen = strlen(s);
-
-        //     while ((isspace(s[pos.x]) || s[pos.x] == '\0') && 
-        //            (pos.x < slen || pos.y + 1 < e->lines.length)) 
-        //     {
-        //         pos = editor_move(e, EK_RIGHT, pos);
-        //         s = editor_get_line(e);
-        //         slen = strlen(s);
-        //     }
-
-        //     if (*strchrnul("{[(", s[pos.x]) != '\0') {
-        //         find_scope_end(e);
-        //         pos = editor_move(e, EK_RIGHT, pos);
-        //     } else {
-        //         while ((*strchrnul("{[(", s[pos.x]) == '\0') &&
-        //                (pos.x < slen || pos.y + 1 < e->lines.length)) 
-        //         {
-        //             pos = editor_move(e, EK_RIGHT, pos);
-        //             s = editor_get_line(e);
-        //         }
-        //     }
-        // } break;
+            e->select_cur = block.from;
+            cur = block.from + block.n;
+        } break;
 
         case EK_SELECT_HOME: {
             cur = editor_move(e, EK_HOME, cur);
@@ -637,21 +652,37 @@ static size_t editor_select(Editor *e, EditorKey key, size_t cur)
 
 static void editor_search_start(Editor *e)
 {
+    e->cursors.size = 0;
     e->searchbuf[0] = '\0';
     e->mode = EM_SEARCHING;
 }
 
+static bool editor_match_at(Editor *e, const char *s, size_t n, size_t at)
+{
+    if (at + n > be_size(&e->be)) return false;
+    for (size_t i = 0; i < n; i++) {
+        if (be_char_at(&e->be, at + i) != s[i]) return false;
+    }
+    return true;
+}
+
+static bool editor_search_match(Editor *e, size_t at)
+{
+    return editor_match_at(e, e->searchbuf, strlen(e->searchbuf), at);
+}
+
 static int editor_search_next(Editor *e, size_t cur)
 {
+    be_index_wait(&e->be);
     size_t i;
-    for (i = cur; i < e->be.data.size; i++) {
-        if (strncmp(e->searchbuf, &e->be.data.data[i], strlen(e->searchbuf)) == 0) {
+    for (i = cur; i < be_size(&e->be); i++) {
+        if (editor_search_match(e, i)) {
             return i;
         }
     }
 
     for (i = 0; i < cur; i++) {
-        if (strncmp(e->searchbuf, &e->be.data.data[i], strlen(e->searchbuf)) == 0) {
+        if (editor_search_match(e, i)) {
             return i;
         }   
     }
@@ -661,15 +692,16 @@ static int editor_search_next(Editor *e, size_t cur)
 
 static int editor_search_prev(Editor *e, size_t cur)
 {
+    be_index_wait(&e->be);
     int i;
     for (i = cur; i >= 0; i--) {
-        if (strncmp(e->searchbuf, &e->be.data.data[i], strlen(e->searchbuf)) == 0) {
+        if (editor_search_match(e, i)) {
             return i;
         }
     }
 
-    for (i = (int) e->be.data.size - 1; i > (int) cur; i--) {
-        if (strncmp(e->searchbuf, &e->be.data.data[i], strlen(e->searchbuf)) == 0) {
+    for (i = (int) be_size(&e->be) - 1; i > (int) cur; i--) {
+        if (editor_search_match(e, i)) {
             return i;
         }
     }
@@ -678,7 +710,254 @@ static int editor_search_prev(Editor *e, size_t cur)
 }
 
 
-static_assert(EK_COUNT == 52, "The number of editor keys has changed");
+/* Multiple cursors */
+
+static int cursor_cmp(const void *ap, const void *bp)
+{
+    const Cursor *a = ap;
+    const Cursor *b = bp;
+    return (a->cur > b->cur) - (a->cur < b->cur);
+}
+
+// Keeps the extra cursors sorted, dropping the ones that landed on another
+static void editor_cursors_normalize(Editor *e)
+{
+    qsort(e->cursors.data, e->cursors.size, sizeof(Cursor), cursor_cmp);
+
+    size_t k = 0;
+    for (size_t i = 0; i < e->cursors.size; i++) {
+        Cursor c = e->cursors.data[i];
+        if (c.cur == e->be.cur) continue;
+        if (k > 0 && e->cursors.data[k - 1].cur == c.cur) continue;
+        e->cursors.data[k++] = c;
+    }
+    e->cursors.size = k;
+}
+
+typedef struct {
+    Range range;
+    bool main; // made from be.cur
+} Cursor_Edit;
+
+static int cursor_edit_cmp(const void *ap, const void *bp)
+{
+    const Cursor_Edit *a = ap;
+    const Cursor_Edit *b = bp;
+    return (a->range.from > b->range.from) - (a->range.from < b->range.from);
+}
+
+// Makes the same edit at every cursor in a single pass: s replaces each
+// selection, or without one the `before` characters before and the `after`
+// characters after each cursor. Returns the new place of the main cursor.
+static size_t editor_edit_cursors(Editor *e, const char *s, size_t before, size_t after)
+{
+    size_t count = e->cursors.size + 1;
+    Cursor_Edit *edits = malloc(count * sizeof(Cursor_Edit));
+    Range *ranges = malloc(count * sizeof(Range));
+    assert(edits != NULL && ranges != NULL);
+
+    for (size_t i = 0; i < count; i++) {
+        Cursor c = (i == 0) ? (Cursor) { e->be.cur, e->select_cur } : e->cursors.data[i - 1];
+        size_t from = c.cur;
+        size_t to = c.cur;
+        if (e->mode == EM_SELECTION) {
+            if (c.anchor < c.cur) from = c.anchor;
+            if (c.anchor > c.cur) to = c.anchor;
+        } else {
+            for (size_t j = 0; j < before; j++) from = be_prev_char(&e->be, from);
+            for (size_t j = 0; j < after; j++) to = be_next_char(&e->be, to);
+        }
+        edits[i] = (Cursor_Edit) { { from, to - from }, i == 0 };
+    }
+    qsort(edits, count, sizeof(Cursor_Edit), cursor_edit_cmp);
+
+    // Overlapping ranges, and cursors at the same place, make a single edit
+    size_t k = 0;
+    for (size_t i = 0; i < count; i++) {
+        Cursor_Edit edit = edits[i];
+        if (k > 0) {
+            Cursor_Edit *prev = &edits[k - 1];
+            size_t prev_end = prev->range.from + prev->range.n;
+            if (edit.range.from < prev_end || edit.range.from == prev->range.from) {
+                size_t end = edit.range.from + edit.range.n;
+                if (end > prev_end) prev->range.n = end - prev->range.from;
+                prev->main |= edit.main;
+                continue;
+            }
+        }
+        edits[k++] = edit;
+    }
+    for (size_t i = 0; i < k; i++) {
+        ranges[i] = edits[i].range;
+    }
+    be_replace_ranges(&e->be, ranges, k, s, strlen(s));
+
+    e->cursors.size = 0;
+    for (size_t i = 0; i < k; i++) {
+        Cursor c = { ranges[i].from + ranges[i].n, ranges[i].from + ranges[i].n };
+        if (edits[i].main) {
+            e->be.cur = c.cur;
+        } else {
+            da_append(&e->cursors, &c);
+        }
+    }
+    e->mode = EM_EDITING;
+    editor_cursors_normalize(e);
+
+    free(ranges);
+    free(edits);
+    return e->be.cur;
+}
+
+// Returns false when the key only works with a single cursor, which it
+// then falls back to
+static bool editor_edit_key_cursors(Editor *e, EditorKey key)
+{
+    if (e->cursors.size == 0) return false;
+
+    if (e->mode == EM_SELECTION) {
+        e->be.cur = editor_edit_cursors(e, "", 0, 0);
+        return true;
+    }
+
+    switch (key) {
+        case EK_BACKSPACE: e->be.cur = editor_edit_cursors(e, "", 1, 0); break;
+        case EK_DELETE:    e->be.cur = editor_edit_cursors(e, "", 0, 1); break;
+        case EK_TAB:       e->be.cur = editor_edit_cursors(e, "    ", 0, 0); break;
+        case EK_RETURN:
+        case EK_BREAK_LINE: e->be.cur = editor_edit_cursors(e, "\n", 0, 0); break;
+        default: {
+            e->cursors.size = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Moves the extra cursors along with the main one, or makes them leave their
+// selections the same way it does
+static void editor_move_cursors(Editor *e, EditorKey key, bool leave_selection)
+{
+    for (size_t i = 0; i < e->cursors.size; i++) {
+        Cursor *c = &e->cursors.data[i];
+        if (leave_selection) {
+            if (((key == EK_UP   || key == EK_LEFT ) && c->cur > c->anchor) ||
+                ((key == EK_DOWN || key == EK_RIGHT) && c->cur < c->anchor))
+            {
+                c->cur = c->anchor;
+            }
+        } else {
+            c->cur = editor_move(e, key, c->cur);
+        }
+        c->anchor = c->cur;
+    }
+    editor_cursors_normalize(e);
+}
+
+// Extends the selections of the extra cursors like the main one. Selecting
+// whole words, lines or blocks only applies to the main cursor.
+static void editor_select_cursors(Editor *e, EditorKey key)
+{
+    EditorKey move;
+    switch (key) {
+        case EK_SELECT_LEFT:           move = EK_LEFT; break;
+        case EK_SELECT_RIGHT:          move = EK_RIGHT; break;
+        case EK_SELECT_UP:             move = EK_UP; break;
+        case EK_SELECT_DOWN:           move = EK_DOWN; break;
+        case EK_SELECT_LEFTW:          move = EK_LEFTW; break;
+        case EK_SELECT_RIGHTW:         move = EK_RIGHTW; break;
+        case EK_SELECT_LINE_HOME:      move = EK_LINE_HOME; break;
+        case EK_SELECT_LINE_END:       move = EK_LINE_END; break;
+        case EK_SELECT_NEXT_PARAGRAPH: move = EK_NEXT_PARAGRAPH; break;
+        case EK_SELECT_PREV_PARAGRAPH: move = EK_PREV_PARAGRAPH; break;
+        default: {
+            e->cursors.size = 0;
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < e->cursors.size; i++) {
+        Cursor *c = &e->cursors.data[i];
+        if (e->mode != EM_SELECTION) c->anchor = c->cur;
+        c->cur = editor_move(e, move, c->cur);
+    }
+}
+
+// Adds a cursor on the line above the topmost cursor or below the bottommost
+static void editor_add_cursor(Editor *e, EditorKey key)
+{
+    if (e->mode == EM_SELECTION) {
+        e->mode = EM_EDITING;
+        for (size_t i = 0; i < e->cursors.size; i++) {
+            e->cursors.data[i].anchor = e->cursors.data[i].cur;
+        }
+    }
+
+    size_t from = e->be.cur;
+    if (e->cursors.size > 0) {
+        size_t first = e->cursors.data[0].cur;
+        size_t last = e->cursors.data[e->cursors.size - 1].cur;
+        if (key == EK_CURSOR_ABOVE && first < from) from = first;
+        if (key == EK_CURSOR_BELOW && last > from) from = last;
+    }
+
+    size_t cur = editor_move(e, (key == EK_CURSOR_ABOVE) ? EK_UP : EK_DOWN, from);
+    if (cur == from) return;
+
+    Cursor c = { cur, cur };
+    da_append(&e->cursors, &c);
+    editor_cursors_normalize(e);
+}
+
+// Selects the word under the cursor, then adds a cursor selecting the next
+// occurrence of the selection after the last one each time
+static void editor_add_cursor_at_next_match(Editor *e)
+{
+    if (e->mode != EM_SELECTION) {
+        e->cursors.size = 0;
+        e->be.cur = editor_select(e, EK_SELECT_WORD, e->be.cur);
+        return;
+    }
+
+    size_t begin = (e->select_cur < e->be.cur) ? e->select_cur : e->be.cur;
+    size_t n = (e->select_cur < e->be.cur) ? e->be.cur - e->select_cur : e->select_cur - e->be.cur;
+    if (n == 0) return;
+
+    be_index_wait(&e->be);
+    char *s = malloc(n);
+    assert(s != NULL);
+    be_copy_n(&e->be, s, begin, n);
+
+    size_t from = (e->select_cur > e->be.cur) ? e->select_cur : e->be.cur;
+    for (size_t i = 0; i < e->cursors.size; i++) {
+        Cursor c = e->cursors.data[i];
+        if (c.cur > from) from = c.cur;
+        if (c.anchor > from) from = c.anchor;
+    }
+
+    // Wraps around, and stops at a selection that is already there
+    size_t size = be_size(&e->be);
+    for (size_t i = 0; i < size; i++) {
+        size_t at = (from + i) % size;
+        if (!editor_match_at(e, s, n, at)) continue;
+        if (at == begin) break;
+
+        bool taken = false;
+        for (size_t j = 0; j < e->cursors.size && !taken; j++) {
+            Cursor c = e->cursors.data[j];
+            taken = ((c.cur < c.anchor) ? c.cur : c.anchor) == at;
+        }
+        if (taken) break;
+
+        Cursor c = (e->be.cur > e->select_cur) ? (Cursor) { at + n, at } : (Cursor) { at, at + n };
+        da_append(&e->cursors, &c);
+        editor_cursors_normalize(e);
+        break;
+    }
+    free(s);
+}
+
+static_assert(EK_COUNT == 57, "The number of editor keys has changed");
 
 /* File I/O */
 
@@ -700,32 +979,84 @@ void editor_open(Editor *e, String_View path)
 
     mode_t mode = statbuf.st_mode & S_IFMT;
     if (mode == S_IFDIR) { // Directory
+        be_set_storage(&e->be, BE_STORAGE_GAP_BUFFER);
         open_dir(e, pathname);
         e->mode = EM_BROWSING;
     } else if (mode == S_IFREG) { // Regular file
-        open_file(e, pathname);
+        open_file(e, pathname, statbuf.st_size);
         e->mode = EM_EDITING;
+        // Still edited as it is, with the invalid bytes drawn as replacement characters
+        if (e->be.utf8_error != SIZE_MAX) {
+            fprintf(stderr, "WARNING: %s is not valid UTF-8 at byte %zu\n", pathname, e->be.utf8_error);
+        }
     }
     sb_remove_from(&e->pathname, e->pathname.size - 1);
 }
 
 static void save_file(const Editor *e)
 {
-    FILE *file = fopen(e->pathname.data, "w");
+    // Truncating a mapped or paged file would pull the text from under the
+    // editor, so it is written next to it and then renamed over it instead
+    bool mapped = e->be.storage == BE_STORAGE_PIECE_TABLE && (pt_mapped(&e->be.pt) || be_paged(&e->be));
+    char *filename = e->pathname.data;
+    if (mapped) {
+        filename = malloc(e->pathname.size + sizeof(".save"));
+        assert(filename != NULL);
+        sprintf(filename, "%s.save", e->pathname.data);
+    }
+
+    FILE *file = fopen(filename, "w");
     if (file == NULL) {
-        fprintf(stderr, "Could not open file \"%s\": %s\n", e->pathname.data, strerror(errno));
+        fprintf(stderr, "Could not open file \"%s\": %s\n", filename, strerror(errno));
         exit(1);
     }
 
-    fwrite(e->be.data.data, 1, e->be.data.size, file);
+    for (size_t at = 0; at < be_size(&e->be);) {
+        size_t n;
+        const char *s = be_span(&e->be, at, &n);
+        fwrite(s, 1, n, file);
+        at += n;
+    }
     fclose(file);
+
+    if (mapped) {
+        struct stat statbuf;
+        if (stat(e->pathname.data, &statbuf) == 0) chmod(filename, statbuf.st_mode & 07777);
+        if (rename(filename, e->pathname.data) != 0) {
+            fprintf(stderr, "Could not replace file \"%s\": %s\n", e->pathname.data, strerror(errno));
+            exit(1);
+        }
+        free(filename);
+    }
 }       
 
-static void open_file(Editor *e, const char *filename)
+static void open_file(Editor *e, const char *filename, size_t size)
 {
+    // Small files are typed into a gap buffer. Big ones are mapped and
+    // edited through a piece table, so they are never copied into memory.
+    // Files too big for even their line table to fit are paged in on demand.
+    // Big files that cannot be mapped are read into a piece table, or into
+    // a rope when huge, which needs no separate line table.
+    if (size > MAPPED_MAX_SIZE && be_page_file(&e->be, filename)) return;
+    if (size > GAP_BUFFER_MAX_SIZE && be_map_file(&e->be, filename)) return;
+
+    Be_Storage storage = BE_STORAGE_ROPE;
+    if (size <= GAP_BUFFER_MAX_SIZE) {
+        storage = BE_STORAGE_GAP_BUFFER;
+    } else if (size <= PIECE_TABLE_MAX_SIZE) {
+        storage = BE_STORAGE_PIECE_TABLE;
+    }
+    be_set_storage(&e->be, storage);
     be_load_from_file(&e->be, filename);
 }
 
+void editor_update(Editor *e)
+{
+    if (e->mode == EM_BROWSING) return;
+    be_check_mapped_file(&e->be, e->pathname.data);
+    be_index_poll(&e->be);
+}
+
 static int entrycmp(const void *ap, const void *bp)
 {
     const char *a = *(const char**)ap;
@@ -761,12 +1092,14 @@ static void open_dir(Editor *e, const char *dirname)
     qsort(entries.data, entries.size, TYPESIZE(&entries), entrycmp);
 
     size_t cur = e->be.cur;
+    be_begin(&e->be);
     for (size_t i = 0; i < entries.size; i++) {
         cur = editor_write_at(e, entries.data[i], cur);
         if (i + 1 != entries.size) {
             cur = editor_write_at(e, "\n", cur);
         }
     }
+    be_commit(&e->be);
 
     da_end(&entries);
 }
@@ -1,194 +1,1033 @@
 #include "be/basic_editor.h"
+#include "job.h"
 #include "lexer.h"
+#include "scan.h"
 
 #include <assert.h>
-#include <ctype.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
 static void be_recompute_lines(Basic_Editor *be);
+static void be_scan_pages(Basic_Editor *be);
+static void be_index_start(Basic_Editor *be);
+static void be_index_stop(Basic_Editor *be);
+
+struct Be_Indexer {
+    Job *job;          // NULL when no longer running
+    const char *text;  // original text
+    size_t size;
+
+    // Used by whoever is scanning
+    size_t at;         // scanned up to here
+    size_t home;       // of the line being scanned
+    size_t block_home;
+    Line_Block block;  // being filled
+
+    // Shared, under the job lock
+    Line_Blocks ready; // handed over but not yet in the line index
+    Ci_Blocks ready_chars; // the same text for the character index
+    Ci_Blocks ready_blanks; // and for the blank lines
+    size_t utf8_error;
+    size_t scanned;
+    bool done;
+
+    // Main thread only
+    size_t indexed;    // original text in the line index, up to the last newline
+    size_t frontier;   // end of the indexed text in the edited text
+};
+
+static void be_text_init(Basic_Editor *be, char *data, size_t size)
+{
+    switch (be->storage) {
+        case BE_STORAGE_PIECE_TABLE: {
+            pt_clear(&be->pt);
+            pt_init(&be->pt, data, size);
+        } break;
+
+        case BE_STORAGE_GAP_BUFFER: {
+            gb_end(&be->gb);
+            gb_init(&be->gb, data, size);
+        } break;
+
+        case BE_STORAGE_ROPE: {
+            rope_clear(&be->rope);
+            rope_insert(&be->rope, data, size, 0);
+            free(data);
+        } break;
+
+        default:
+            assert(0 && "unreachable");
+    }
+}
+
+static void be_text_end(Basic_Editor *be)
+{
+    be_index_stop(be);
+    pt_end(&be->pt);
+    gb_end(&be->gb);
+    rope_end(&be->rope);
+}
+
+// Streams the file into the rope leaf by leaf so that loading never needs
+// a second copy of the whole file
+static void be_load_rope(Basic_Editor *be, const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        perror("fopen");
+        exit(1);
+    }
+
+    rope_clear(&be->rope);
+    char buf[16 * ROPE_LEAF_MAX];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        rope_insert(&be->rope, buf, n, rope_size(&be->rope));
+    }
+    if (ferror(f)) {
+        perror("fread");
+        exit(1);
+    }
+    fclose(f);
+}
 
 void be_load_from_file(Basic_Editor *be, const char *filename)
 {
-    char *data = read_entire_file(filename);
-    be->data.data = data;
-    be->data.size = strlen(data);
-    be->data.capacity = be->data.size;
+    if (be->storage == BE_STORAGE_ROPE) {
+        be_load_rope(be, filename);
+    } else {
+        size_t size;
+        char *data = read_entire_file(filename, &size);
+        be_text_init(be, data, size);
+    }
+    be->cur = 0;
+    jn_clear(&be->journal);
+    be_recompute_lines(be);
+}
+
+bool be_map_file(Basic_Editor *be, const char *filename)
+{
+    size_t size;
+    File_Stamp stamp;
+    char *data = map_entire_file(filename, &size, &stamp);
+    if (data == NULL) return false;
+
+    be_text_end(be);
+    be->storage = BE_STORAGE_PIECE_TABLE;
+    pt_init_mapped(&be->pt, data, size);
+    be->mapped_file = stamp;
+    be->cur = 0;
+    jn_clear(&be->journal);
+    be_index_start(be);
+    return true;
+}
+
+bool be_page_file(Basic_Editor *be, const char *filename)
+{
+    size_t size;
+    File_Stamp stamp;
+    int fd = open_entire_file(filename, &size, &stamp);
+    if (fd < 0) return false;
+
+    Page_Cache *pc = malloc(sizeof(*pc));
+    assert(pc != NULL);
+    pc_init(pc, fd, size);
+
+    be_text_end(be);
+    be->storage = BE_STORAGE_PIECE_TABLE;
+    pt_init_paged(&be->pt, pc);
+    be->mapped_file = stamp;
     be->cur = 0;
+    jn_clear(&be->journal);
+    be_scan_pages(be);
+    return true;
+}
+
+bool be_paged(const Basic_Editor *be)
+{
+    return be->storage == BE_STORAGE_PIECE_TABLE && pt_paged(&be->pt) != NULL;
+}
+
+void be_set_page_budget(Basic_Editor *be, size_t bytes)
+{
+    if (be_paged(be)) pc_set_budget(pt_paged(&be->pt), bytes);
+}
+
+void be_check_mapped_file(Basic_Editor *be, const char *filename)
+{
+    if (be->storage != BE_STORAGE_PIECE_TABLE || (!pt_mapped(&be->pt) && !be_paged(be))) return;
+
+    // A file that was deleted or replaced by a new one (which is how it is
+    // saved) leaves the mapped one intact
+    File_Stamp stamp;
+    if (!file_stamp(filename, &stamp)) return;
+    if (!file_stamp_same_file(stamp, be->mapped_file)) return;
+    if (file_stamp_eq(stamp, be->mapped_file)) return;
+
+    bool edited = pt_added(&be->pt) > 0 || be->pt.size != pt_original_size(&be->pt);
+    if (!edited) {
+        size_t cur = be->cur;
+        if (be_paged(be) ? be_page_file(be, filename) : be_map_file(be, filename)) {
+            be->cur = (cur < be_size(be)) ? cur : be_size(be);
+            return;
+        }
+    }
+
+    // A paged file is too big to be copied, so the pages read from then on
+    // have whatever the file holds, zeros past its new end
+    if (be_paged(be)) return;
+
+    // Pages past the new end of a truncated file can no longer be read
+    be_index_stop(be);
+    size_t readable = (stamp.size > 0) ? (size_t) stamp.size : 0;
+    pt_detach(&be->pt, readable);
+    be_recompute_lines(be);
+    if (be->cur > be_size(be)) be->cur = be_size(be);
+}
+
+void be_set_storage(Basic_Editor *be, Be_Storage storage)
+{
+    if (be->storage == storage) return;
+
+    size_t size = be_size(be);
+    char *data = malloc(size);
+    be_copy_n(be, data, 0, size);
+    be_text_end(be);
+
+    be->storage = storage;
+    be_text_init(be, data, size);
+    be_recompute_lines(be);
+}
+
+Be_Changes be_take_changes(Basic_Editor *be)
+{
+    Be_Changes changes = be->changes;
+    be->changes = (Be_Changes) {0};
+    return changes;
+}
+
+void be_clear(Basic_Editor *be)
+{
+    be_index_stop(be);
+    switch (be->storage) {
+        case BE_STORAGE_PIECE_TABLE: pt_clear(&be->pt); break;
+        case BE_STORAGE_GAP_BUFFER:  gb_clear(&be->gb); break;
+        case BE_STORAGE_ROPE:        rope_clear(&be->rope); break;
+        default: assert(0 && "unreachable");
+    }
+    be->cur = 0;
+    jn_clear(&be->journal);
     be_recompute_lines(be);
 }
 
 void be_destroy(Basic_Editor *be)
 {
-    da_end(&be->lines);
-    sb_end(&be->data);
+    li_end(&be->lines);
+    ci_end(&be->chars);
+    ci_end(&be->blanks);
+    ci_end(&be->page_lines);
+    bi_end(&be->brackets);
+    jn_end(&be->journal);
+    be_text_end(be);
+}
+
+// Text access
+
+static_assert(COUNT_BE_STORAGES == 3, "The number of storage modes has changed");
+
+size_t be_size(const Basic_Editor *be)
+{
+    switch (be->storage) {
+        case BE_STORAGE_PIECE_TABLE: return be->pt.size;
+        case BE_STORAGE_GAP_BUFFER:  return gb_size(&be->gb);
+        case BE_STORAGE_ROPE:        return rope_size(&be->rope);
+        default: assert(0 && "unreachable");
+    }
+    return 0;
+}
+
+char be_char_at(const Basic_Editor *be, size_t at)
+{
+    switch (be->storage) {
+        case BE_STORAGE_PIECE_TABLE: return pt_char_at(&be->pt, at);
+        case BE_STORAGE_GAP_BUFFER:  return gb_char_at(&be->gb, at);
+        case BE_STORAGE_ROPE:        return rope_char_at(&be->rope, at);
+        default: assert(0 && "unreachable");
+    }
+    return '\0';
+}
+
+const char *be_span(const Basic_Editor *be, size_t at, size_t *n)
+{
+    switch (be->storage) {
+        case BE_STORAGE_PIECE_TABLE: return pt_span(&be->pt, at, n);
+        case BE_STORAGE_GAP_BUFFER:  return gb_span(&be->gb, at, n);
+        case BE_STORAGE_ROPE:        return rope_span(&be->rope, at, n);
+        default: assert(0 && "unreachable");
+    }
+    *n = 0;
+    return NULL;
+}
+
+void be_copy_n(const Basic_Editor *be, char *dst, size_t from, size_t n)
+{
+    assert(from + n <= be_size(be));
+    while (n > 0) {
+        size_t len;
+        const char *s = be_span(be, from, &len);
+        if (len > n) len = n;
+        memcpy(dst, s, len);
+        dst += len;
+        from += len;
+        n -= len;
+    }
+}
+
+static const char *be_ci_span(const void *be, size_t at, size_t *n)
+{
+    return be_span(be, at, n);
+}
+
+static bool be_char_start(const Basic_Editor *be, size_t at)
+{
+    return at >= be_size(be) || ((unsigned char) be_char_at(be, at) & 0xC0) != 0x80;
+}
+
+size_t be_prev_char(const Basic_Editor *be, size_t at)
+{
+    if (at > 0) at--;
+    while (at > 0 && !be_char_start(be, at)) at--;
+    return at;
+}
+
+size_t be_next_char(const Basic_Editor *be, size_t at)
+{
+    if (at < be_size(be)) at++;
+    while (!be_char_start(be, at)) at++;
+    return at;
 }
 
 // Get
 
+size_t be_line_count(const Basic_Editor *be)
+{
+    if (be->storage == BE_STORAGE_ROPE) {
+        return rope_newlines(&be->rope) + 1;
+    }
+    assert(!be->txn.dirty && "lines are out of date inside a transaction");
+    if (be_paged(be)) return ci_total(&be->page_lines) + 1;
+    return li_row_count(&be->lines);
+}
+
+// The rope keeps its own line metrics, and a paged file only counts its lines
+static bool be_has_line_index(const Basic_Editor *be)
+{
+    return be->storage != BE_STORAGE_ROPE && !be_paged(be);
+}
+
+static size_t be_next_newline(const Basic_Editor *be, size_t from)
+{
+    size_t size = be_size(be);
+    while (from < size) {
+        size_t n;
+        const char *s = be_span(be, from, &n);
+        const char *newline = memchr(s, '\n', n);
+        if (newline != NULL) return from + (newline - s);
+        from += n;
+    }
+    return size;
+}
+
+// The page holding the newline before the row is scanned for it, and the
+// line itself for its end
+static Line be_paged_line(const Basic_Editor *be, size_t row)
+{
+    Line line;
+    line.home = (row > 0) ? ci_offset_of(&be->page_lines, be, be_ci_span, row - 1) + 1 : 0;
+    line.end = be_next_newline(be, line.home);
+    return line;
+}
+
+static size_t be_paged_row_of(const Basic_Editor *be, size_t cur)
+{
+    return ci_char_of(&be->page_lines, be, be_ci_span, cur);
+}
+
+static Line be_rope_line(const Basic_Editor *be, size_t row)
+{
+    assert(row <= rope_newlines(&be->rope));
+    Line line;
+    line.home = rope_row_home(&be->rope, row);
+    line.end = (row < rope_newlines(&be->rope))
+        ? rope_row_home(&be->rope, row + 1) - 1
+        : rope_size(&be->rope);
+    return line;
+}
+
+static bool be_row_cache_valid(const Basic_Editor *be)
+{
+    return be->row_cache.valid && be->row_cache.version == be->version;
+}
+
+Line be_line(const Basic_Editor *be, size_t row)
+{
+    if (be_row_cache_valid(be) && be->row_cache.row == row) {
+        return be->row_cache.line;
+    }
+    if (be->storage == BE_STORAGE_ROPE) {
+        return be_rope_line(be, row);
+    }
+    assert(!be->txn.dirty && "lines are out of date inside a transaction");
+    if (be_paged(be)) return be_paged_line(be, row);
+    Li_Hint hint = be->row_cache.hint;
+    return li_line_hint(&be->lines, row, &hint);
+}
+
 Line be_get_line(const Basic_Editor *be, size_t cur)
 {
-    assert(cur < be->data.size);
-    return be->lines.data[be_cursor_row(be, cur)];
+    assert(cur <= be_size(be));
+    return be_line(be, be_cursor_row(be, cur));
+}
+
+// Without a character index, the characters are counted from the line home
+static size_t be_count_chars(const Basic_Editor *be, size_t from, size_t to)
+{
+    size_t count = 0;
+    while (from < to) {
+        size_t n;
+        const char *s = be_span(be, from, &n);
+        if (n > to - from) n = to - from;
+        count += scan_count_chars(s, n);
+        from += n;
+    }
+    return count;
+}
+
+size_t be_col_of(const Basic_Editor *be, Line line, size_t cur)
+{
+    assert(!be->txn.dirty && "columns are out of date inside a transaction");
+    if (be_paged(be)) return be_count_chars(be, line.home, cur);
+    return ci_char_of(&be->chars, be, be_ci_span, cur)
+        - ci_char_of(&be->chars, be, be_ci_span, line.home);
+}
+
+size_t be_cursor_at_col(const Basic_Editor *be, Line line, size_t col)
+{
+    assert(!be->txn.dirty && "columns are out of date inside a transaction");
+    if (be_paged(be)) {
+        // Stray continuation bytes at the home belong to no column
+        size_t cur = (line.home < line.end && !be_char_start(be, line.home)) ? be_next_char(be, line.home) : line.home;
+        for (; col > 0 && cur < line.end; col--) cur = be_next_char(be, cur);
+        return cur;
+    }
+    size_t home = ci_char_of(&be->chars, be, be_ci_span, line.home);
+    size_t cur = ci_offset_of(&be->chars, be, be_ci_span, home + col);
+    return (cur < line.end) ? cur : line.end;
 }
 
 size_t be_cursor_row(const Basic_Editor *be, size_t cur)
 {
-    assert(be->lines.size > 0);
-    for (size_t row = 0; row < be->lines.size; row++) {
-        Line line = be->lines.data[row];
-        if (line.home <= cur && cur <= line.end) {
-            return row;
-        }
+    if (cur > be_size(be)) cur = be_size(be);
+
+    const Be_Row_Cache *cache = &be->row_cache;
+    if (be_row_cache_valid(be)) {
+        if (cache->line.home <= cur && cur <= cache->line.end) return cache->row;
+        if (cur == cache->line.end + 1) return cache->row + 1;
+        if (cache->row > 0 && cur + 1 == cache->line.home) return cache->row - 1;
+    }
+
+    if (be->storage == BE_STORAGE_ROPE) {
+        return rope_row_of(&be->rope, cur);
+    }
+    assert(!be->txn.dirty && "lines are out of date inside a transaction");
+    if (be_paged(be)) return be_paged_row_of(be, cur);
+    Li_Hint hint = cache->hint;
+    return li_row_of_hint(&be->lines, cur, &hint);
+}
+
+// Same as be_line, but remembers the line in the row cache
+static Line be_fetch_line(Basic_Editor *be, size_t row)
+{
+    Be_Row_Cache *cache = &be->row_cache;
+    if (be_row_cache_valid(be) && cache->row == row) {
+        return cache->line;
+    }
+    assert(!be->txn.dirty && "lines are out of date inside a transaction");
+
+    Line line;
+    if (be->storage == BE_STORAGE_ROPE) {
+        line = be_rope_line(be, row);
+    } else if (be_paged(be)) {
+        line = be_paged_line(be, row);
+    } else {
+        line = li_line_hint(&be->lines, row, &cache->hint);
+    }
+    cache->valid = true;
+    cache->version = be->version;
+    cache->row = row;
+    cache->line = line;
+    return line;
+}
+
+// Same as be_cursor_row, but remembers the row in the row cache
+static size_t be_fetch_row(Basic_Editor *be, size_t cur)
+{
+    if (cur > be_size(be)) cur = be_size(be);
+
+    Be_Row_Cache *cache = &be->row_cache;
+    size_t row;
+    if (be_row_cache_valid(be) && cache->line.home <= cur && cur <= cache->line.end) {
+        return cache->row;
+    } else if (be_row_cache_valid(be) && cur == cache->line.end + 1) {
+        row = cache->row + 1;
+    } else if (be_row_cache_valid(be) && cache->row > 0 && cur + 1 == cache->line.home) {
+        row = cache->row - 1;
+    } else if (be->storage == BE_STORAGE_ROPE) {
+        row = rope_row_of(&be->rope, cur);
+    } else if (be_paged(be)) {
+        row = be_paged_row_of(be, cur);
+    } else {
+        row = li_row_of_hint(&be->lines, cur, &cache->hint);
     }
-    return be->lines.size - 1;
+    be_fetch_line(be, row);
+    return row;
 }
 
 // Move
 
+size_t be_move_left(Basic_Editor *be, size_t cur)
+{
+    cur = be_prev_char(be, cur);
+    be_fetch_row(be, cur);
+    return cur;
+}
+
+size_t be_move_right(Basic_Editor *be, size_t cur)
+{
+    cur = be_next_char(be, cur);
+    be_fetch_row(be, cur);
+    return cur;
+}
+
 size_t be_move_up(Basic_Editor *be, size_t cur)
 {
-    size_t row = be_cursor_row(be, cur);
-    size_t col = cur - be->lines.data[row].home;
+    return be_move_up_n(be, cur, 1);
+}
+
+size_t be_move_down(Basic_Editor *be, size_t cur)
+{
+    return be_move_down_n(be, cur, 1);
+}
 
-    if (row > 0) {
-        Line next_line = be->lines.data[row - 1];
-        size_t next_line_size = next_line.end - next_line.home;
-        if (col > next_line_size) col = next_line_size;
-        cur = next_line.home + col;
+size_t be_move_up_n(Basic_Editor *be, size_t cur, size_t n)
+{
+    size_t row = be_fetch_row(be, cur);
+    size_t col = be_col_of(be, be_fetch_line(be, row), cur);
+    if (n > row) n = row;
+    if (n > 0) {
+        cur = be_cursor_at_col(be, be_fetch_line(be, row - n), col);
     }
     return cur;
 }
 
-size_t be_move_down(Basic_Editor *be, size_t cur)
+size_t be_move_down_n(Basic_Editor *be, size_t cur, size_t n)
 {
-    size_t row = be_cursor_row(be, cur);
-    size_t col = cur - be->lines.data[row].home;
-    if (row + 1 < be->lines.size) {
-        Line next_line = be->lines.data[row + 1];
-        size_t next_line_size = next_line.end - next_line.home;
-        if (col > next_line_size) col = next_line_size;
-        cur = next_line.home + col;
+    size_t row = be_fetch_row(be, cur);
+    size_t col = be_col_of(be, be_fetch_line(be, row), cur);
+    size_t last = be_line_count(be) - 1;
+    if (n > last - row) n = last - row;
+    if (n > 0) {
+        cur = be_cursor_at_col(be, be_fetch_line(be, row + n), col);
     }
     return cur;
 }
 
-#define issymbol(c) (isalnum(c) || c == '_')
-size_t be_move_leftw(Basic_Editor *be, size_t cur)
+size_t be_move_to_row(Basic_Editor *be, size_t row)
 {
-    if (cur > 0) {
-        cur--;
+    size_t last = be_line_count(be) - 1;
+    return be_fetch_line(be, (row < last) ? row : last).home;
+}
+
+// Bytes of multibyte characters are taken as letters
+// Word motions stop where the text turns from word bytes to the others, or
+// back, which the class scans find a span at a time
+
+#define BE_WORD_SET SCAN_CLASS_BIT(SCAN_CLASS_WORD)
+#define BE_NOT_WORD_SET (SCAN_CLASS_BIT(SCAN_CLASS_SPACE) | SCAN_CLASS_BIT(SCAN_CLASS_OTHER))
+
+#ifndef BE_RUN_CHUNK
+#  define BE_RUN_CHUNK 64
+#endif // BE_RUN_CHUNK
+
+static unsigned be_word_set_of(char c)
+{
+    return (scan_class(c) == SCAN_CLASS_WORD) ? BE_WORD_SET : BE_NOT_WORD_SET;
+}
+
+// End of the run of bytes of the classes in `set` starting at `from`
+static size_t be_class_run(const Basic_Editor *be, size_t from, unsigned set)
+{
+    while (from < be_size(be)) {
+        size_t n;
+        const char *s = be_span(be, from, &n);
+        size_t run = scan_class_run(s, n, set);
+        from += run;
+        if (run < n) break;
     }
-    
-    if (cur > 0 && !issymbol(be->data.data[cur])) {
-        while (cur > 0 && !issymbol(be->data.data[cur])) {
-            cur--;
-        }
-        if (cur > 0 && issymbol(be->data.data[cur])) {
-            cur++; // maybe should check against be->data.size
-        }
-    } else {
-        while (cur > 0 && issymbol(be->data.data[cur])) {
-            cur--;
-        }
-        if (cur > 0 && !issymbol(be->data.data[cur])) {
-            cur++; // maybe should check against be->data.size
+    return from;
+}
+
+// Start of the run of bytes of the classes in `set` ending at `to`. Spans
+// only go forwards, so the text before `to` is taken in chunks, each twice
+// the one after it, and scanned forwards for the last byte not in the run.
+static size_t be_class_run_back(const Basic_Editor *be, size_t to, unsigned set)
+{
+    size_t chunk = BE_RUN_CHUNK;
+    for (size_t hi = to; hi > 0; chunk *= 2) {
+        size_t lo = (hi > chunk) ? hi - chunk : 0;
+        size_t start = lo;
+        for (size_t at = lo; at < hi;) {
+            size_t n;
+            const char *s = be_span(be, at, &n);
+            if (n > hi - at) n = hi - at;
+            size_t run = scan_class_run_back(s, n, set);
+            if (run < n) start = at + n - run;
+            at += n;
         }
+        if (start > lo) return start;
+        hi = lo;
     }
+    return 0;
+}
 
-    return cur;
+size_t be_move_leftw(Basic_Editor *be, size_t cur)
+{
+    if (cur == 0) return 0;
+    return be_class_run_back(be, cur, be_word_set_of(be_char_at(be, cur - 1)));
 }
 
 size_t be_move_rightw(Basic_Editor *be, size_t cur)
 {
-    if (cur < be->data.size) {
+    if (cur < be_size(be)) {
         cur++;
     }
-    
-    if (cur < be->data.size && !issymbol(be->data.data[cur])) {
-        while (cur < be->data.size && !issymbol(be->data.data[cur])) {
-            cur++;
-        }
-    } else {
-        while (cur < be->data.size && issymbol(be->data.data[cur])) {
-            cur++;
-        }
+    if (cur < be_size(be)) {
+        cur = be_class_run(be, cur, be_word_set_of(be_char_at(be, cur)));
     }
     return cur;
 }
-#undef issymbol
 
 size_t be_move_home(Basic_Editor *be, size_t cur)
 {
-    Line line = be_get_line(be, cur);
+    Line line = be_fetch_line(be, be_fetch_row(be, cur));
     cur = line.home;
     return cur;
 }
 
 size_t be_move_end(Basic_Editor *be, size_t cur)
 {
-    size_t row = be_cursor_row(be, cur);
-    Line line = be->lines.data[row];
+    size_t row = be_fetch_row(be, cur);
+    Line line = be_fetch_line(be, row);
     cur = line.end;
     return cur;
 }
 
+// Empty lines are found by the newline ending them, which is their home.
+// The blank line index counts them, and a paged file, which has no such
+// index, is scanned for them. The last line has none, but it is only empty
+// at the end of the text.
+
+// Home of the first, or the last, empty line starting in [from, to), `to`
+// if there is none
+static size_t be_scan_blank(const Basic_Editor *be, size_t from, size_t to, bool last)
+{
+    size_t found = to;
+    char prev = (from > 0) ? be_char_at(be, from - 1) : '\n';
+    while (from < to) {
+        size_t n;
+        const char *s = be_span(be, from, &n);
+        if (n > to - from) n = to - from;
+        for (const char *p = s; (p = memchr(p, '\n', s + n - p)) != NULL; p++) {
+            if (((p > s) ? p[-1] : prev) != '\n') continue;
+            found = from + (p - s);
+            if (!last) return found;
+        }
+        prev = s[n - 1];
+        from += n;
+    }
+    return found;
+}
+
+// Home of the first empty line starting from `from`, the end of the indexed
+// text if there is none
+static size_t be_next_blank(const Basic_Editor *be, size_t from)
+{
+    if (be_paged(be)) return be_scan_blank(be, from, be_size(be), false);
+    size_t blank = ci_char_of(&be->blanks, be, be_ci_span, from);
+    return ci_offset_of(&be->blanks, be, be_ci_span, blank);
+}
+
+// Home of the last empty line starting before `to`, SIZE_MAX if there is none
+static size_t be_prev_blank(const Basic_Editor *be, size_t to)
+{
+    if (!be_paged(be)) {
+        size_t blank = ci_char_of(&be->blanks, be, be_ci_span, to);
+        return (blank > 0) ? ci_offset_of(&be->blanks, be, be_ci_span, blank - 1) : SIZE_MAX;
+    }
+
+    // A page at a time backwards
+    for (size_t hi = to; hi > 0;) {
+        size_t lo = (hi > PC_PAGE_SIZE) ? hi - PC_PAGE_SIZE : 0;
+        size_t found = be_scan_blank(be, lo, hi, true);
+        if (found < hi) return found;
+        hi = lo;
+    }
+    return SIZE_MAX;
+}
+
 size_t be_move_next_paragraph(Basic_Editor *be, size_t cur)
 {
-    size_t row = 0;
-    Line line = {0};
-    do {
-        cur = be_move_down(be, cur);
-        row = be_cursor_row(be, cur);
-        line = be->lines.data[row];
-    } while (row < be->lines.size && line.home != line.end);
-    return cur;
+    size_t row = be_fetch_row(be, cur);
+    size_t last = be_line_count(be) - 1;
+    if (row < last) {
+        cur = be_next_blank(be, be_fetch_line(be, row).end + 1);
+        if (cur < be_indexed_size(be)) {
+            be_fetch_row(be, cur);
+            return cur;
+        }
+    }
+    return be_fetch_line(be, last).end;
 }
 
 size_t be_move_prev_paragraph(Basic_Editor *be, size_t cur)
 {
-    size_t row = 0;
-    Line line = {0};
-    do {
-        cur = be_move_up(be, cur);
-        row = be_cursor_row(be, cur);
-        line = be->lines.data[row];
-    } while (row > 0 && line.home != line.end);
+    size_t row = be_fetch_row(be, cur);
+    cur = be_prev_blank(be, be_fetch_line(be, row).home);
+    if (cur == SIZE_MAX) cur = 0;
+    be_fetch_row(be, cur);
     return cur;
 }
 
+// Blocks
+
+// The bracket index is only lexed when it is asked for, from the start of the
+// text up to where the answer is found. It looks BE_BRACKETS_AHEAD bytes past
+// the query first, then twice as far every time the closing bracket is not in
+// sight, up to the indexed frontier of a mapped file.
+#ifndef BE_BRACKETS_AHEAD
+#  define BE_BRACKETS_AHEAD (64 * 1024)
+#endif // BE_BRACKETS_AHEAD
+
+// Returns whether the brackets now reach the end of the text
+static bool be_brackets_sync(Basic_Editor *be, size_t at, size_t ahead)
+{
+    size_t end = be_indexed_size(be);
+    size_t size = (end - at > ahead) ? at + ahead : end;
+    bi_sync(&be->brackets, be, be_ci_span, size);
+    return bi_size(&be->brackets) == end;
+}
+
+static bool be_block(Range *block, size_t open, size_t close)
+{
+    *block = (Range) { open, close + 1 - open };
+    return true;
+}
+
+bool be_outer_block(Basic_Editor *be, size_t from, size_t to, Range *block)
+{
+    if (be_paged(be) || to > be_indexed_size(be)) return false;
+    for (size_t ahead = BE_BRACKETS_AHEAD;; ahead *= 2) {
+        bool done = be_brackets_sync(be, to, ahead);
+        size_t open, close;
+        if (bi_enclosing(&be->brackets, be, be_ci_span, from, to, &open, &close)) return be_block(block, open, close);
+        if (open == SIZE_MAX || done) return false;
+    }
+}
+
+bool be_next_block(Basic_Editor *be, size_t at, Range *block)
+{
+    if (be_paged(be) || at > be_indexed_size(be)) return false;
+    for (size_t ahead = BE_BRACKETS_AHEAD;; ahead *= 2) {
+        bool done = be_brackets_sync(be, at, ahead);
+        size_t open, close;
+        if (bi_next_pair(&be->brackets, be, be_ci_span, at, &open, &close)) return be_block(block, open, close);
+        if (done) return false;
+    }
+}
+
 // Manipulation
 
 size_t be_backspace(Basic_Editor *be)
 {
     if (be->cur > 0) {
-        be_delete_n_from(be, 1, --be->cur);
+        size_t from = be_prev_char(be, be->cur);
+        be_delete_n_from(be, be->cur - from, from);
+        be->cur = from;
     }
     return be->cur;
 }
 
 void be_delete(Basic_Editor *be)
 {
-    if (be->cur >= be->data.size) return;
-    be_delete_n_from(be, 1, be->cur);
+    if (be->cur >= be_size(be)) return;
+    be_delete_n_from(be, be_next_char(be, be->cur) - be->cur, be->cur);
+}
+
+// Widens the changed text of the transaction to cover an edit
+static void be_txn_insert(Be_Transaction *txn, size_t n, size_t at)
+{
+    if (!txn->dirty) {
+        txn->dirty = true;
+        txn->from = txn->to = at;
+        txn->delta = 0;
+    }
+    if (at < txn->from) txn->from = at;
+    txn->to = (at <= txn->to) ? txn->to + n : at + n;
+    txn->delta += n;
+}
+
+static void be_txn_delete(Be_Transaction *txn, size_t n, size_t from)
+{
+    if (!txn->dirty) {
+        txn->dirty = true;
+        txn->from = txn->to = from;
+        txn->delta = 0;
+    }
+    if (from < txn->from) txn->from = from;
+    txn->to = ((txn->to > from + n) ? txn->to : from + n) - n;
+    txn->delta -= n;
+}
+
+// Widens the changes to cover the edit that replaced `removed` bytes at `from`
+static void be_changes_add(Be_Changes *changes, size_t from, size_t removed, size_t inserted)
+{
+    if (changes->reset) return;
+    if (!changes->dirty) {
+        changes->dirty = true;
+        changes->from = changes->to = from;
+        changes->delta = 0;
+    }
+    size_t to = (changes->to > from + removed) ? changes->to : from + removed;
+    if (from < changes->from) changes->from = from;
+    changes->to = to - removed + inserted;
+    changes->delta += inserted - removed;
+}
+
+// The character, blank line and bracket indexes, or the newline counts of a
+// paged file, follow the edit that replaced `removed` bytes at `from`, and so do
+// the changes
+static void be_counts_update(Basic_Editor *be, size_t from, size_t removed, size_t inserted)
+{
+    if (be_paged(be)) {
+        ci_update(&be->page_lines, be, be_ci_span, from, removed, inserted);
+    } else {
+        ci_update(&be->chars, be, be_ci_span, from, removed, inserted);
+        ci_update(&be->blanks, be, be_ci_span, from, removed, inserted);
+        bi_update(&be->brackets, from, removed, inserted);
+    }
+    be_changes_add(&be->changes, from, removed, inserted);
+}
+
+// The indexes still have the changed text as it was before the
+// transaction, which is replaced by a single scan of what it is now
+static void be_txn_flush(Basic_Editor *be)
+{
+    Be_Transaction *txn = &be->txn;
+    if (!txn->dirty) return;
+    txn->dirty = false;
+
+    size_t removed = (txn->to - txn->from) - txn->delta;
+    if (be_has_line_index(be)) {
+        li_delete(&be->lines, removed, txn->from);
+        for (size_t at = txn->from; at < txn->to;) {
+            size_t n;
+            const char *s = be_span(be, at, &n);
+            if (n > txn->to - at) n = txn->to - at;
+            li_insert(&be->lines, s, n, at);
+            at += n;
+        }
+    }
+    be_counts_update(be, txn->from, removed, txn->to - txn->from);
+    be->version++;
+}
+
+// Edits of the text and everything derived from it, without recording them
+static void be_text_insert(Basic_Editor *be, const char *s, size_t n, size_t at)
+{
+    if (n == 0) return;
+    if (be->indexer != NULL) be->indexer->frontier += n;
+    switch (be->storage) {
+        case BE_STORAGE_PIECE_TABLE: pt_insert(&be->pt, s, n, at); break;
+        case BE_STORAGE_GAP_BUFFER:  gb_insert(&be->gb, s, n, at); break;
+        case BE_STORAGE_ROPE:        rope_insert(&be->rope, s, n, at); break;
+        default: assert(0 && "unreachable");
+    }
+    if (be->txn.depth > 0) {
+        be_txn_insert(&be->txn, n, at);
+    } else {
+        if (be_has_line_index(be)) li_insert(&be->lines, s, n, at);
+        be_counts_update(be, at, 0, n);
+    }
+    be->version++;
+}
+
+static void be_text_delete(Basic_Editor *be, size_t n, size_t from)
+{
+    if (n == 0) return;
+    if (be->indexer != NULL) be->indexer->frontier -= n;
+
+    switch (be->storage) {
+        case BE_STORAGE_PIECE_TABLE: pt_delete(&be->pt, n, from); break;
+        case BE_STORAGE_GAP_BUFFER:  gb_delete(&be->gb, n, from); break;
+        case BE_STORAGE_ROPE:        rope_delete(&be->rope, n, from); break;
+        default: assert(0 && "unreachable");
+    }
+    if (be->txn.depth > 0) {
+        be_txn_delete(&be->txn, n, from);
+    } else {
+        if (be_has_line_index(be)) li_delete(&be->lines, n, from);
+        be_counts_update(be, from, n, 0);
+    }
+    be->version++;
 }
 
 size_t be_insert_sn_at(Basic_Editor *be, const char *s, size_t n, size_t at)
 {
-    if (at > be->data.size) {
-        at = be->data.size;
+    if (at > be_indexed_size(be)) {
+        at = be_indexed_size(be);
     }
-    da_insert_n(&be->data, s, n, at);
-    be_recompute_lines(be);
+    jn_insert(&be->journal, s, n, at);
+    be_text_insert(be, s, n, at);
     return at + n;
 }
 
 void be_delete_n_from(Basic_Editor *be, size_t n, size_t from)
 {
-    da_remove_n_from(&be->data, n, from);
-    be_recompute_lines(be);
+    // Text past the indexing frontier cannot be edited yet
+    size_t limit = be_indexed_size(be);
+    if (from > limit) from = limit;
+    if (n > limit - from) n = limit - from;
+    if (n == 0) return;
+
+    char *removed = jn_delete(&be->journal, n, from);
+    if (removed != NULL) be_copy_n(be, removed, from, n);
+    be_text_delete(be, n, from);
+}
+
+// The character index reads the edited text, so it is updated left to right,
+// where everything before a range is already where it ended up. Ranges that
+// are less than two blocks apart may share a block and are counted together,
+// and so may the block after them, which blank lines count again.
+static void be_replace_chars(Basic_Editor *be, const Range *ranges, size_t count, size_t n)
+{
+    size_t block_max = be_paged(be) ? be->page_lines.block_max : CI_BLOCK_MAX;
+    size_t shift = 0;
+    for (size_t i = 0; i < count;) {
+        size_t removed = ranges[i].n;
+        size_t j = i + 1;
+        for (; j < count; j++) {
+            size_t prev_end = ranges[j - 1].from + ranges[j - 1].n;
+            if (ranges[j].from - prev_end >= 2 * block_max) break;
+            removed += ranges[j].n;
+        }
+        size_t from = ranges[i].from;
+        size_t to = ranges[j - 1].from + ranges[j - 1].n;
+        size_t inserted = (to - from) - removed + (j - i) * n;
+        be_counts_update(be, from + shift, to - from, inserted);
+        shift += inserted - (to - from);
+        i = j;
+    }
+}
+
+void be_replace_ranges(Basic_Editor *be, Range *ranges, size_t count, const char *s, size_t n)
+{
+    if (count == 0) return;
+    Range last = ranges[count - 1];
+    if (last.from + last.n > be_indexed_size(be)) be_index_wait(be);
+
+    // Recorded as it will have happened, each range moved by the edits before it
+    Journal *jn = &be->journal;
+    jn_begin(jn);
+    size_t shift = 0; // wraps around when the text shrinks
+    for (size_t i = 0; i < count; i++) {
+        size_t at = ranges[i].from + shift;
+        if (ranges[i].n > 0) {
+            char *removed = jn_delete(jn, ranges[i].n, at);
+            if (removed != NULL) be_copy_n(be, removed, ranges[i].from, ranges[i].n);
+        }
+        jn_insert(jn, s, n, at);
+        shift += n - ranges[i].n;
+    }
+    jn_commit(jn);
+
+    switch (be->storage) {
+        case BE_STORAGE_PIECE_TABLE: {
+            pt_replace(&be->pt, ranges, count, s, n);
+        } break;
+
+        case BE_STORAGE_GAP_BUFFER: {
+            // Left to right, so the gap sweeps over the text once
+            shift = 0;
+            for (size_t i = 0; i < count; i++) {
+                size_t at = ranges[i].from + shift;
+                gb_delete(&be->gb, ranges[i].n, at);
+                gb_insert(&be->gb, s, n, at);
+                shift += n - ranges[i].n;
+            }
+        } break;
+
+        case BE_STORAGE_ROPE: {
+            for (size_t i = count; i > 0; i--) {
+                rope_delete(&be->rope, ranges[i - 1].n, ranges[i - 1].from);
+                rope_insert(&be->rope, s, n, ranges[i - 1].from);
+            }
+        } break;
+
+        default:
+            assert(0 && "unreachable");
+    }
+
+    if (be->txn.depth > 0) {
+        // Rescanned at the commit, from the first range to the end of the last
+        size_t from = ranges[0].from;
+        size_t to = last.from + last.n;
+        be_txn_delete(&be->txn, to - from, from);
+        be_txn_insert(&be->txn, to - from + shift, from);
+    } else {
+        // Right to left, so every range is still where it was
+        if (be_has_line_index(be)) {
+            for (size_t i = count; i > 0; i--) {
+                li_delete(&be->lines, ranges[i - 1].n, ranges[i - 1].from);
+                li_insert(&be->lines, s, n, ranges[i - 1].from);
+            }
+        }
+        be_replace_chars(be, ranges, count, n);
+    }
+    if (be->indexer != NULL) be->indexer->frontier += shift;
+    be->version++;
+
+    shift = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t removed = ranges[i].n;
+        ranges[i].from += shift;
+        ranges[i].n = n;
+        shift += n - removed;
+    }
+}
+
+void be_begin(Basic_Editor *be)
+{
+    be->txn.depth++;
+    jn_begin(&be->journal);
+}
+
+void be_commit(Basic_Editor *be)
+{
+    assert(be->txn.depth > 0);
+    jn_commit(&be->journal);
+    if (--be->txn.depth == 0) be_txn_flush(be);
 }
 
 size_t be_insert_line_above(Basic_Editor *be, size_t cur)
@@ -204,21 +1043,528 @@ size_t be_insert_line_below(Basic_Editor *be, size_t cur)
     return be_insert_sn_at(be, "\n", 1, line.end);
 }
 
+// Undo
+
+bool be_undo(Basic_Editor *be)
+{
+    Journal *jn = &be->journal;
+    size_t n = jn_undo(jn);
+    for (size_t i = jn->done + n; i > jn->done; i--) {
+        const Jn_Delta *delta = &jn->deltas.data[i - 1];
+        be_text_delete(be, delta->inserted, delta->at);
+        be_text_insert(be, jn_removed(jn, delta), delta->removed, delta->at);
+        be->cur = delta->at + delta->removed;
+    }
+    return n > 0;
+}
+
+bool be_redo(Basic_Editor *be)
+{
+    Journal *jn = &be->journal;
+    size_t n = jn_redo(jn);
+    for (size_t i = jn->done - n; i < jn->done; i++) {
+        const Jn_Delta *delta = &jn->deltas.data[i];
+        be_text_delete(be, delta->removed, delta->at);
+        be_text_insert(be, jn_inserted(jn, delta), delta->inserted, delta->at);
+        be->cur = delta->at + delta->inserted;
+    }
+    return n > 0;
+}
+
+void be_undo_seal(Basic_Editor *be)
+{
+    jn_seal(&be->journal);
+}
+
+
+void be_set_undo_limit(Basic_Editor *be, size_t bytes)
+{
+    jn_set_limit(&be->journal, bytes);
+}
+
 // Maintenance
 
+#define BE_SCAN_CHUNK 4096
+#ifndef BE_INDEX_CHUNK
+#  define BE_INDEX_CHUNK (1 << 20)
+#endif // BE_INDEX_CHUNK
+
+// First byte that is not valid UTF-8 in the characters starting in
+// [from, to), SIZE_MAX if there is none. `from` is the start of a character.
+static size_t be_utf8_error(const Basic_Editor *be, size_t from, size_t to)
+{
+    size_t size = be_size(be);
+    size_t at = from;
+    while (at < to) {
+        size_t n;
+        const char *s = be_span(be, at, &n);
+        if (n > to - at) n = to - at;
+        size_t valid = scan_utf8_valid(s, n);
+        at += valid;
+        if (valid == n) continue;
+
+        // The character is either invalid or goes on after the span
+        char c[4];
+        size_t m = (size - at < sizeof(c)) ? size - at : sizeof(c);
+        be_copy_n(be, c, at, m);
+        valid = scan_utf8_valid(c, m);
+        if (valid == 0) return at;
+        at += valid;
+    }
+    // Only continuation bytes that belong to no character are left here
+    return be_char_start(be, at) ? SIZE_MAX : at;
+}
+
+// Parallel indexing: every chunk of the text first counts its newlines, a
+// prefix sum over the counts gives each chunk its place in the global list
+// of newlines, and then every chunk scans again writing straight into it.
+// The first pass also cuts the chunk into character and blank line index
+// blocks and validates it.
+#define BE_INDEX_CHUNK_BLOCKS ((BE_INDEX_CHUNK + CI_BLOCK_MAX - 1) / CI_BLOCK_MAX)
+
+typedef struct {
+    const Basic_Editor *be;
+    size_t *counts;
+    size_t *newlines;
+    Ci_Block *chars;      // BE_INDEX_CHUNK_BLOCKS per chunk
+    Ci_Block *blanks;     // the same
+    size_t *utf8_errors;
+} Be_Index;
+
+static void be_index_count(void *ctx, size_t c)
+{
+    Be_Index *index = ctx;
+    const Basic_Editor *be = index->be;
+    size_t home = c * BE_INDEX_CHUNK;
+    size_t end = home + BE_INDEX_CHUNK;
+    if (end > be_size(be)) end = be_size(be);
+
+    size_t count = 0;
+    Ci_Block *blocks = index->chars + c * BE_INDEX_CHUNK_BLOCKS;
+    Ci_Block *blanks = index->blanks + c * BE_INDEX_CHUNK_BLOCKS;
+    for (size_t i = 0; i < BE_INDEX_CHUNK_BLOCKS; i++) {
+        blocks[i] = blanks[i] = (Ci_Block) {0};
+    }
+    char prev = (home > 0) ? be_char_at(be, home - 1) : '\n';
+    for (size_t at = home; at < end;) {
+        size_t n;
+        const char *s = be_span(be, at, &n);
+        if (n > end - at) n = end - at;
+        count += scan_count_newlines(s, n);
+
+        // Cut at the span and block boundaries
+        for (size_t i = 0; i < n;) {
+            size_t b = (at + i - home) / CI_BLOCK_MAX;
+            Ci_Block *block = &blocks[b];
+            size_t m = CI_BLOCK_MAX - block->bytes;
+            if (m > n - i) m = n - i;
+            block->bytes += m;
+            block->chars += scan_count_chars(s + i, m);
+            blanks[b].bytes += m;
+            blanks[b].chars += scan_count_blank_lines(s + i, m, prev);
+            prev = s[i + m - 1];
+            i += m;
+        }
+        at += n;
+    }
+    index->counts[c] = count;
+
+    // A character cut by the chunk boundary is validated with the chunk it starts in
+    size_t from = home;
+    while (from < end && !be_char_start(be, from)) from++;
+    index->utf8_errors[c] = (c > 0 && from == end) ? SIZE_MAX : be_utf8_error(be, (c > 0) ? from : home, end);
+}
+
+static void be_index_scan(void *ctx, size_t c)
+{
+    Be_Index *index = ctx;
+    size_t end = (c + 1) * BE_INDEX_CHUNK;
+    if (end > be_size(index->be)) end = be_size(index->be);
+
+    size_t *out = index->newlines + index->counts[c];
+    for (size_t at = c * BE_INDEX_CHUNK; at < end;) {
+        size_t n;
+        const char *s = be_span(index->be, at, &n);
+        if (n > end - at) n = end - at;
+        out += scan_newlines(s, n, at, out);
+        at += n;
+    }
+}
+
+static void be_recompute_lines_parallel(Basic_Editor *be)
+{
+    size_t chunks = (be_size(be) + BE_INDEX_CHUNK - 1) / BE_INDEX_CHUNK;
+    Be_Index index = {
+        .be = be,
+        .counts = malloc(chunks * sizeof(size_t)),
+        .chars = malloc(chunks * BE_INDEX_CHUNK_BLOCKS * sizeof(Ci_Block)),
+        .blanks = malloc(chunks * BE_INDEX_CHUNK_BLOCKS * sizeof(Ci_Block)),
+        .utf8_errors = malloc(chunks * sizeof(size_t)),
+    };
+    assert(index.counts != NULL && index.chars != NULL && index.blanks != NULL && index.utf8_errors != NULL);
+    job_parallel_for(chunks, be_index_count, &index);
+
+    for (size_t c = 0; c < chunks; c++) {
+        Ci_Block *blocks = index.chars + c * BE_INDEX_CHUNK_BLOCKS;
+        size_t n = 0;
+        while (n < BE_INDEX_CHUNK_BLOCKS && blocks[n].bytes > 0) n++;
+        ci_append_blocks(&be->chars, blocks, n);
+        ci_append_blocks(&be->blanks, index.blanks + c * BE_INDEX_CHUNK_BLOCKS, n);
+        if (be->utf8_error == SIZE_MAX) be->utf8_error = index.utf8_errors[c];
+    }
+
+    size_t total = 0;
+    for (size_t c = 0; c < chunks; c++) {
+        size_t count = index.counts[c];
+        index.counts[c] = total;
+        total += count;
+    }
+
+    index.newlines = malloc((total > 0 ? total : 1) * sizeof(size_t));
+    assert(index.newlines != NULL);
+    job_parallel_for(chunks, be_index_scan, &index);
+    li_build(&be->lines, index.newlines, total, be_size(be));
+
+    free(index.newlines);
+    free(index.counts);
+    free(index.chars);
+    free(index.blanks);
+    free(index.utf8_errors);
+}
+
+// Appends the newlines of text[from, to) to the line index being built
+static void be_index_range(Basic_Editor *be, size_t from, size_t to)
+{
+    size_t newlines[BE_SCAN_CHUNK];
+    for (size_t at = from; at < to;) {
+        size_t n;
+        const char *s = be_span(be, at, &n);
+        if (n > to - at) n = to - at;
+        for (size_t i = 0; i < n; i += BE_SCAN_CHUNK) {
+            size_t m = (n - i < BE_SCAN_CHUNK) ? n - i : BE_SCAN_CHUNK;
+            size_t k = scan_newlines(s + i, m, at + i, newlines);
+            li_append_n(&be->lines, newlines, k);
+        }
+        at += n;
+    }
+}
+
+// A paged file keeps no line or character index, which would grow with the
+// file, only the newline counts of its pages
+static void be_pages_reset(Basic_Editor *be)
+{
+    be_index_stop(be);
+    be->version++;
+    be->txn.dirty = false;
+    be->changes = (Be_Changes) { .dirty = true, .reset = true };
+    li_end(&be->lines);
+    ci_end(&be->chars);
+    ci_end(&be->blanks);
+    bi_end(&be->brackets);
+    ci_clear(&be->page_lines);
+    be->page_lines.unit = CI_NEWLINES;
+    be->page_lines.block_max = 2 * PC_PAGE_SIZE;
+    be->utf8_error = SIZE_MAX;
+}
+
+// Pages are read straight from the file, in parallel and past the cache,
+// with a few bytes on either side for the characters cut by their ends
+typedef struct {
+    const Page_Cache *pc;
+    Ci_Block *pages;
+    size_t *utf8_errors;
+} Be_Page_Scan;
+
+#define BE_PAGE_MARGIN 3
+
+static void be_scan_page(void *ctx, size_t p)
+{
+    Be_Page_Scan *scan = ctx;
+    size_t home = p * PC_PAGE_SIZE;
+    size_t before = (home < BE_PAGE_MARGIN) ? home : BE_PAGE_MARGIN;
+    char *buf = malloc(PC_PAGE_SIZE + 2 * BE_PAGE_MARGIN);
+    assert(buf != NULL);
+    size_t got = pc_read(scan->pc, home - before, buf, before + PC_PAGE_SIZE + BE_PAGE_MARGIN) - before;
+    const char *s = buf + before;
+    size_t n = (got < PC_PAGE_SIZE) ? got : PC_PAGE_SIZE;
+    scan->pages[p] = (Ci_Block) { n, scan_count_newlines(s, n) };
+
+    // A valid character cut by the home of the page belongs to the page before
+    size_t from = 0;
+    for (size_t i = 1; i <= before; i++) {
+        unsigned char c = s[-(ptrdiff_t) i];
+        if ((c & 0xC0) == 0x80) continue;
+        size_t len = (c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : (c >= 0xC0) ? 2 : 1;
+        if (len > i && len - i <= got && scan_utf8_valid(s - i, len) == len) from = len - i;
+        break;
+    }
+    size_t valid = scan_utf8_valid(s + from, got - from);
+    scan->utf8_errors[p] = (from + valid < n) ? home + from + valid : SIZE_MAX;
+    free(buf);
+}
+
+static void be_scan_pages(Basic_Editor *be)
+{
+    be_pages_reset(be);
+    Page_Cache *pc = pt_paged(&be->pt);
+    size_t count = pc_page_count(pc);
+    Be_Page_Scan scan = {
+        .pc = pc,
+        .pages = malloc(count * sizeof(Ci_Block)),
+        .utf8_errors = malloc(count * sizeof(size_t)),
+    };
+    assert(count == 0 || (scan.pages != NULL && scan.utf8_errors != NULL));
+    job_parallel_for(count, be_scan_page, &scan);
+
+    ci_append_blocks(&be->page_lines, scan.pages, count);
+    for (size_t p = 0; p < count && be->utf8_error == SIZE_MAX; p++) {
+        be->utf8_error = scan.utf8_errors[p];
+    }
+    free(scan.pages);
+    free(scan.utf8_errors);
+}
+
 static void be_recompute_lines(Basic_Editor *be)
 {
-    be->lines.size = 0;
-    Line line;
-    line.home = 0;
-    for (size_t i = 0; i < be->data.size; i++) {
-        if (be->data.data[i] == '\n') {
-            line.end = i;
-            da_append(&be->lines, &line);
-            line.home = i + 1;
+    if (be_paged(be)) {
+        be_pages_reset(be);
+        ci_append(&be->page_lines, be, be_ci_span, be_size(be));
+        be->utf8_error = be_utf8_error(be, 0, be_size(be));
+        return;
+    }
+
+    be_index_stop(be);
+    be->version++;
+    be->txn.dirty = false;
+    be->changes = (Be_Changes) { .dirty = true, .reset = true };
+    li_clear(&be->lines);
+    ci_clear(&be->chars);
+    ci_clear(&be->blanks);
+    be->blanks.unit = CI_BLANK_LINES;
+    bi_clear(&be->brackets);
+    be->utf8_error = SIZE_MAX;
+
+    // Rows of the rope come from its metrics
+    if (be->storage != BE_STORAGE_ROPE && job_threads() > 1 && be_size(be) >= 2 * BE_INDEX_CHUNK) {
+        be_recompute_lines_parallel(be);
+        return;
+    }
+
+    ci_append(&be->chars, be, be_ci_span, be_size(be));
+    ci_append(&be->blanks, be, be_ci_span, be_size(be));
+    be->utf8_error = be_utf8_error(be, 0, be_size(be));
+    if (be->storage == BE_STORAGE_ROPE) return;
+    be_index_range(be, 0, be_size(be));
+    li_finish(&be->lines, be_size(be));
+}
+
+// Progressive indexing of a freshly mapped file. The first screens are
+// indexed right away and a job scans the rest of the original text, handing
+// over whole blocks of lines. The main thread moves them into the line index
+// from be_index_poll, so the line index itself is never shared. Edits are
+// only allowed before the frontier, which means the unindexed rest of the
+// text is the unedited original shifted by the total size change.
+
+#ifndef BE_INDEX_FIRST
+#  define BE_INDEX_FIRST (1 << 20)
+#endif // BE_INDEX_FIRST
+
+// The main thread side of the job lock
+static void be_indexer_lock(Be_Indexer *indexer)
+{
+    if (indexer->job != NULL) job_lock(indexer->job);
+}
+
+static void be_indexer_unlock(Be_Indexer *indexer)
+{
+    if (indexer->job != NULL) job_unlock(indexer->job);
+}
+
+// `job` is the running job when called from it, and NULL before it is started.
+// The text of the block is also validated and cut into character and blank
+// line index blocks. Blocks end after a newline, so no character is cut
+// between two.
+static void be_indexer_hand_over(Be_Indexer *indexer, Job *job, bool done)
+{
+    size_t end = done ? indexer->size : indexer->home;
+    indexer->block.bytes = end - indexer->block_home;
+
+    const char *s = indexer->text + indexer->block_home;
+    size_t n = indexer->block.bytes;
+    size_t valid = scan_utf8_valid(s, n);
+    Ci_Block *chars = malloc(2 * (n / CI_BLOCK_MAX + 1) * sizeof(*chars));
+    assert(chars != NULL);
+    Ci_Block *blanks = chars + n / CI_BLOCK_MAX + 1;
+    char prev = (indexer->block_home > 0) ? s[-1] : '\n';
+    size_t k = ci_make_blocks(chars, CI_CHARS, s, n, prev);
+    ci_make_blocks(blanks, CI_BLANK_LINES, s, n, prev);
+
+    if (job != NULL) job_lock(job);
+    da_append(&indexer->ready, &indexer->block);
+    da_append_n(&indexer->ready_chars, chars, k);
+    da_append_n(&indexer->ready_blanks, blanks, k);
+    if (valid < n && indexer->utf8_error == SIZE_MAX) indexer->utf8_error = indexer->block_home + valid;
+    indexer->done = done;
+    if (job != NULL) job_unlock(job);
+    free(chars);
+
+    indexer->block = (Line_Block) {0};
+    indexer->block_home = indexer->home;
+}
+
+// Blocks are handed over well before their homes run out of 32 bits
+static void be_indexer_push(Be_Indexer *indexer)
+{
+    assert(indexer->home - indexer->block_home <= LI_HOME_MAX);
+    Li_Home home = indexer->home - indexer->block_home;
+    da_append(&indexer->block.homes, &home);
+}
+
+// Scans the original text up to `until`. Blocks are handed over when they
+// are full, or already big in bytes so that long lines show up soon enough.
+static void be_indexer_scan(Be_Indexer *indexer, Job *job, size_t until)
+{
+    size_t newlines[BE_SCAN_CHUNK];
+    while (indexer->at < until && (job == NULL || !job_cancelled(job))) {
+        size_t n = until - indexer->at;
+        if (n > BE_SCAN_CHUNK) n = BE_SCAN_CHUNK;
+        size_t k = scan_newlines(indexer->text + indexer->at, n, indexer->at, newlines);
+        for (size_t i = 0; i < k; i++) {
+            be_indexer_push(indexer);
+            indexer->home = newlines[i] + 1;
+            if (indexer->block.homes.size >= LI_BLOCK_MAX
+                || indexer->home - indexer->block_home >= BE_INDEX_CHUNK) {
+                be_indexer_hand_over(indexer, job, false);
+            }
         }
+        indexer->at += n;
+
+        if (job != NULL) job_lock(job);
+        indexer->scanned = indexer->at;
+        if (job != NULL) job_unlock(job);
+    }
+
+    if (indexer->at == indexer->size) {
+        be_indexer_push(indexer);
+        be_indexer_hand_over(indexer, job, true);
     }
-    line.end = be->data.size;
-    da_append(&be->lines, &line);
 }
 
+static void be_indexer_task(Job *job, void *ctx)
+{
+    Be_Indexer *indexer = ctx;
+    be_indexer_scan(indexer, job, indexer->size);
+}
+
+static void be_index_start(Basic_Editor *be)
+{
+    assert(be->storage == BE_STORAGE_PIECE_TABLE);
+    be_index_stop(be);
+    be->version++;
+    be->txn.dirty = false;
+    be->changes = (Be_Changes) { .dirty = true, .reset = true };
+    li_clear(&be->lines);
+    li_finish(&be->lines, 0);
+    ci_clear(&be->chars);
+    ci_clear(&be->blanks);
+    be->blanks.unit = CI_BLANK_LINES;
+    bi_clear(&be->brackets);
+    be->utf8_error = SIZE_MAX;
+
+    Be_Indexer *indexer = calloc(1, sizeof(*indexer));
+    assert(indexer != NULL);
+    indexer->text = be->pt.original->data;
+    indexer->size = pt_original_size(&be->pt);
+    indexer->utf8_error = SIZE_MAX;
+    be->indexer = indexer;
+
+    be_indexer_scan(indexer, NULL, (indexer->size < BE_INDEX_FIRST) ? indexer->size : BE_INDEX_FIRST);
+    if (!indexer->done && indexer->block.homes.size > 0) be_indexer_hand_over(indexer, NULL, false);
+    be_index_poll(be);
+
+    if (be->indexer != NULL) indexer->job = job_start(be_indexer_task, indexer);
+}
+
+static void be_index_stop(Basic_Editor *be)
+{
+    Be_Indexer *indexer = be->indexer;
+    if (indexer == NULL) return;
+
+    if (indexer->job != NULL) job_cancel(indexer->job);
+    for (size_t i = 0; i < indexer->ready.size; i++) {
+        da_clear(&indexer->ready.data[i].homes);
+    }
+    da_clear(&indexer->ready);
+    da_clear(&indexer->ready_chars);
+    da_clear(&indexer->ready_blanks);
+    da_clear(&indexer->block.homes);
+    free(indexer);
+    be->indexer = NULL;
+}
+
+bool be_indexing(const Basic_Editor *be)
+{
+    return be->indexer != NULL;
+}
+
+size_t be_indexed_size(const Basic_Editor *be)
+{
+    return (be->indexer != NULL) ? be->indexer->frontier : be_size(be);
+}
+
+float be_index_progress(const Basic_Editor *be)
+{
+    Be_Indexer *indexer = be->indexer;
+    if (indexer == NULL) return 1.0f;
+
+    be_indexer_lock(indexer);
+    size_t scanned = indexer->scanned;
+    be_indexer_unlock(indexer);
+    return (float) scanned / (float) indexer->size;
+}
+
+void be_index_poll(Basic_Editor *be)
+{
+    Be_Indexer *indexer = be->indexer;
+    if (indexer == NULL) return;
+
+    be_indexer_lock(indexer);
+    Line_Blocks ready = indexer->ready;
+    Ci_Blocks ready_chars = indexer->ready_chars;
+    Ci_Blocks ready_blanks = indexer->ready_blanks;
+    bool done = indexer->done;
+    be->utf8_error = indexer->utf8_error;
+    da_zero(&indexer->ready);
+    da_zero(&indexer->ready_chars);
+    da_zero(&indexer->ready_blanks);
+    be_indexer_unlock(indexer);
+
+    if (ready.size > 0) {
+        for (size_t i = 0; i < ready.size; i++) {
+            indexer->indexed += ready.data[i].bytes;
+        }
+        li_append_blocks(&be->lines, ready.data, ready.size, done);
+        ci_append_blocks(&be->chars, ready_chars.data, ready_chars.size);
+        // The blocks were counted after the original text, which edits at
+        // the frontier may have changed, so the first one is counted again
+        size_t frontier = ci_size(&be->blanks);
+        ci_append_blocks(&be->blanks, ready_blanks.data, ready_blanks.size);
+        if (frontier < ci_size(&be->blanks)) ci_update(&be->blanks, be, be_ci_span, frontier, 1, 1);
+        size_t delta = be_size(be) - indexer->size; // wraps around when the text shrank
+        indexer->frontier = indexer->indexed + delta;
+        be->version++;
+    }
+    da_clear(&ready);
+    da_clear(&ready_chars);
+    da_clear(&ready_blanks);
+
+    if (done) be_index_stop(be);
+}
+
+void be_index_wait(Basic_Editor *be)
+{
+    if (be->indexer == NULL) return;
+    if (be->indexer->job != NULL) job_wait(be->indexer->job);
+    be->indexer->job = NULL;
+    be_index_poll(be);
+}
@@ -1,9 +1,15 @@
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "be/common.h"
 
@@ -12,7 +18,7 @@
     *size = ftell(fp);       \
     rewind(fp);
 
-char *read_entire_file(const char *filename)
+char *read_entire_file(const char *filename, size_t *size)
 {
     FILE *f = fopen(filename, "r");
     if (f == NULL) {
@@ -20,12 +26,11 @@ char *read_entire_file(const char *filename)
         exit(1);
     }
 
-    size_t size;
-    FILESIZE(f, &size);
-    char *data = malloc(size);
-    assert(data != NULL);
+    FILESIZE(f, size);
+    char *data = malloc(*size);
+    assert(*size == 0 || data != NULL);
 
-    fread(data, size, 1, f);
+    fread(data, *size, 1, f);
     if (ferror(f)) {
         perror("fread");
         exit(1);
@@ -34,3 +39,66 @@ char *read_entire_file(const char *filename)
     
     return data;
 }
+
+static void file_stamp_from_stat(const struct stat *st, File_Stamp *stamp)
+{
+    stamp->dev = st->st_dev;
+    stamp->ino = st->st_ino;
+    stamp->size = st->st_size;
+    stamp->mtime_sec = st->st_mtim.tv_sec;
+    stamp->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+bool file_stamp(const char *filename, File_Stamp *stamp)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0) return false;
+    file_stamp_from_stat(&st, stamp);
+    return true;
+}
+
+bool file_stamp_same_file(File_Stamp a, File_Stamp b)
+{
+    return a.dev == b.dev && a.ino == b.ino;
+}
+
+bool file_stamp_eq(File_Stamp a, File_Stamp b)
+{
+    return file_stamp_same_file(a, b) && a.size == b.size
+        && a.mtime_sec == b.mtime_sec && a.mtime_nsec == b.mtime_nsec;
+}
+
+int open_entire_file(const char *filename, size_t *size, File_Stamp *stamp)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    *size = st.st_size;
+    file_stamp_from_stat(&st, stamp);
+    return fd;
+}
+
+char *map_entire_file(const char *filename, size_t *size, File_Stamp *stamp)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        // Private, so the text can never be changed through the mapping
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) data = NULL;
+    }
+    close(fd);
+    if (data == NULL) return NULL;
+
+    *size = st.st_size;
+    file_stamp_from_stat(&st, stamp);
+    return data;
+}
@@ -0,0 +1,156 @@
+#include "be/snapshot.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *snap_ci_span(const void *snap, size_t at, size_t *n)
+{
+    return snap_span(snap, at, n);
+}
+
+// Every line of the line index but the last one of the text ends with a
+// newline, so its blocks hold a newline per home
+static void snap_sum_lines(Be_Snapshot *snap, const Line_Index *li)
+{
+    size_t count = li->blocks.size;
+    Ci_Block *blocks = malloc(count * sizeof(*blocks));
+    assert(count == 0 || blocks != NULL);
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        const Line_Block *block = &li->blocks.data[i];
+        if (block->bytes == 0) continue;
+        blocks[n++] = (Ci_Block) { block->bytes, block->homes.size - (i + 1 == count) };
+    }
+    ci_append_blocks(&snap->lines, blocks, n);
+    free(blocks);
+}
+
+Be_Snapshot *be_snapshot(const Basic_Editor *be)
+{
+    assert(!be->txn.dirty && "lines are out of date inside a transaction");
+    Be_Snapshot *snap = calloc(1, sizeof(*snap));
+    assert(snap != NULL);
+    atomic_init(&snap->refs, 1);
+    snap->version = be->version;
+    snap->indexed = be_indexed_size(be);
+    snap->lines.unit = CI_NEWLINES;
+
+    switch (be->storage) {
+        case BE_STORAGE_ROPE: {
+            snap->storage = BE_STORAGE_ROPE;
+            snap->rope = rope_share(&be->rope);
+        } break;
+
+        case BE_STORAGE_PIECE_TABLE: {
+            snap->storage = BE_STORAGE_PIECE_TABLE;
+            pt_share(&be->pt, &snap->pt);
+            if (be_paged(be)) {
+                ci_append_blocks(&snap->lines, be->page_lines.blocks.data, be->page_lines.blocks.size);
+            } else {
+                snap_sum_lines(snap, &be->lines);
+            }
+        } break;
+
+        case BE_STORAGE_GAP_BUFFER: {
+            size_t size = be_size(be);
+            char *copy = malloc(size);
+            assert(size == 0 || copy != NULL);
+            be_copy_n(be, copy, 0, size);
+            snap->storage = BE_STORAGE_PIECE_TABLE;
+            pt_init(&snap->pt, copy, size);
+            snap_sum_lines(snap, &be->lines);
+        } break;
+
+        default:
+            assert(0 && "unreachable");
+    }
+    assert(snap->storage == BE_STORAGE_ROPE || ci_size(&snap->lines) == snap->indexed);
+    return snap;
+}
+
+Be_Snapshot *snap_retain(Be_Snapshot *snap)
+{
+    atomic_fetch_add(&snap->refs, 1);
+    return snap;
+}
+
+void snap_release(Be_Snapshot *snap)
+{
+    if (atomic_fetch_sub(&snap->refs, 1) > 1) return;
+    pt_end(&snap->pt);
+    rope_end(&snap->rope);
+    ci_end(&snap->lines);
+    free(snap);
+}
+
+// Text access
+
+size_t snap_size(const Be_Snapshot *snap)
+{
+    if (snap->storage == BE_STORAGE_ROPE) return rope_size(&snap->rope);
+    return snap->pt.size;
+}
+
+const char *snap_span(const Be_Snapshot *snap, size_t at, size_t *n)
+{
+    if (snap->storage == BE_STORAGE_ROPE) return rope_span(&snap->rope, at, n);
+    return pt_span(&snap->pt, at, n);
+}
+
+void snap_copy_n(const Be_Snapshot *snap, char *dst, size_t from, size_t n)
+{
+    assert(from + n <= snap_size(snap));
+    while (n > 0) {
+        size_t len;
+        const char *s = snap_span(snap, from, &len);
+        if (len > n) len = n;
+        memcpy(dst, s, len);
+        dst += len;
+        from += len;
+        n -= len;
+    }
+}
+
+// Rows
+
+size_t snap_line_count(const Be_Snapshot *snap)
+{
+    if (snap->storage == BE_STORAGE_ROPE) return rope_newlines(&snap->rope) + 1;
+    return ci_total(&snap->lines) + 1;
+}
+
+Line snap_line(const Be_Snapshot *snap, size_t row)
+{
+    assert(row < snap_line_count(snap));
+    Line line;
+    if (snap->storage == BE_STORAGE_ROPE) {
+        line.home = rope_row_home(&snap->rope, row);
+        line.end = (row < rope_newlines(&snap->rope))
+            ? rope_row_home(&snap->rope, row + 1) - 1
+            : rope_size(&snap->rope);
+        return line;
+    }
+
+    // The newline before the row is found in its block, and the one after it by a scan
+    line.home = (row > 0) ? ci_offset_of(&snap->lines, snap, snap_ci_span, row - 1) + 1 : 0;
+    line.end = line.home;
+    while (line.end < snap->indexed) {
+        size_t n;
+        const char *s = snap_span(snap, line.end, &n);
+        if (n > snap->indexed - line.end) n = snap->indexed - line.end;
+        const char *newline = memchr(s, '\n', n);
+        if (newline != NULL) return (Line) { line.home, line.end + (newline - s) };
+        line.end += n;
+    }
+    return line;
+}
+
+size_t snap_row_of(const Be_Snapshot *snap, size_t at)
+{
+    if (snap->storage == BE_STORAGE_ROPE) {
+        return rope_row_of(&snap->rope, (at < rope_size(&snap->rope)) ? at : rope_size(&snap->rope));
+    }
+    if (at > snap->indexed) at = snap->indexed;
+    return ci_char_of(&snap->lines, snap, snap_ci_span, at);
+}
@@ -35,7 +35,7 @@ Vec2f ftr_render_s_n(
     const char *s, size_t n, Vec2f pos, Vec4f c)
 {
     for (size_t i = 0; i < n; i++) {
-        Glyph_Info gi = ftr->gi[(int) s[i]];
+        Glyph_Info gi = ftr->gi[(unsigned char) s[i]];
         float x2 = pos.x + gi.bl;
         float y2 = -pos.y - gi.bt;
         float w  = gi.bw;
@@ -60,7 +60,7 @@ float ftr_get_s_width_n(FreeType_Renderer *ftr, const char *s, size_t n)
 {
     float width = 0;
     for (size_t i = 0; i < n; i++) {
-        width += ftr->gi[(int) s[i]].ax;
+        width += ftr->gi[(unsigned char) s[i]].ax;
     }
     return width;
 }
@@ -71,7 +71,7 @@ float ftr_get_s_width_n_pad(FreeType_Renderer *ftr, const char *s, size_t n, cha
     size_t slen = 0;
     float width = ftr_get_s_width_n(ftr, s, slen);
 
-    float ax = ftr->gi[(int) pad].ax;
+    float ax = ftr->gi[(unsigned char) pad].ax;
     while (i++ < n) {
         width += ax;
     }
@@ -104,7 +104,7 @@ size_t ftr_get_index_near_pad(FreeType_Renderer *ftr, const char *s,
     size_t slen = strlen(s);
     float current_width = 0;
 
-    float ax = ftr->gi[(int) pad].ax;
+    float ax = ftr->gi[(unsigned char) pad].ax;
 
     for (i = 0; current_width < width; i++) {
         if (i <= slen) {
@@ -116,14 +116,24 @@ size_t ftr_get_index_near_pad(FreeType_Renderer *ftr, const char *s,
     return (i > 0) ? i - 1 : i;
 }
 
+// The glyphs in the atlas are ASCII followed by the replacement character,
+// whose place in gi is the first byte that starts a multibyte character
+#define FTR_REPLACEMENT 0xC0
+#define FTR_GLYPHS 129
+
+static size_t ftr_glyph_code(size_t i)
+{
+    return (i < 128) ? i : 0xFFFD;
+}
+
 static void init_glyph_texture_atlas(FreeType_Renderer *ftr, FT_Face face)
 {
     // The last flag makes the loading quite slow
     FT_Int32 load_flags = FT_LOAD_RENDER | FT_LOAD_TARGET_(FT_RENDER_MODE_SDF);
     
-    for (size_t i = 32; i < 128; i++) {
+    for (size_t i = 32; i < FTR_GLYPHS; i++) {
         FT_Error error;
-        if ((error = FT_Load_Char(face, i, load_flags))) {
+        if ((error = FT_Load_Char(face, ftr_glyph_code(i), load_flags))) {
             fprintf(stderr, "ERROR: %s\n", FT_Error_String(error));
             exit(1);
         }
@@ -153,19 +163,21 @@ static void init_glyph_texture_atlas(FreeType_Renderer *ftr, FT_Face face)
 
     int x = 0;
     FT_Error error;
-    for (size_t i = 32; i < 128; i++) {
-        if ((error = FT_Load_Char(face, i, load_flags))) {
+    memset(ftr->gi, 0, sizeof(ftr->gi));
+    for (size_t i = 32; i < FTR_GLYPHS; i++) {
+        if ((error = FT_Load_Char(face, ftr_glyph_code(i), load_flags))) {
             fprintf(stderr, "ERROR: %s\n", FT_Error_String(error));
             exit(1);
         }
 
-        ftr->gi[i].ax = face->glyph->advance.x >> 6;
-        ftr->gi[i].ay = face->glyph->advance.y >> 6;
-        ftr->gi[i].bw = face->glyph->bitmap.width;
-        ftr->gi[i].bh = face->glyph->bitmap.rows;
-        ftr->gi[i].bl = face->glyph->bitmap_left;
-        ftr->gi[i].bt = face->glyph->bitmap_top;
-        ftr->gi[i].tx = (float) x / (float) ftr->atlas_w;
+        Glyph_Info *gi = &ftr->gi[(i < 128) ? i : FTR_REPLACEMENT];
+        gi->ax = face->glyph->advance.x >> 6;
+        gi->ay = face->glyph->advance.y >> 6;
+        gi->bw = face->glyph->bitmap.width;
+        gi->bh = face->glyph->bitmap.rows;
+        gi->bl = face->glyph->bitmap_left;
+        gi->bt = face->glyph->bitmap_top;
+        gi->tx = (float) x / (float) ftr->atlas_w;
 
         glTexSubImage2D(
             GL_TEXTURE_2D, 0, x, 0, face->glyph->bitmap.width, 
@@ -174,4 +186,9 @@ static void init_glyph_texture_atlas(FreeType_Renderer *ftr, FT_Face face)
 
         x += face->glyph->bitmap.width;
     }
+
+    // Continuation bytes stay empty
+    for (size_t i = FTR_REPLACEMENT + 1; i < 256; i++) {
+        ftr->gi[i] = ftr->gi[FTR_REPLACEMENT];
+    }
 }
@@ -0,0 +1,145 @@
+#define _DEFAULT_SOURCE
+
+#include "job.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifndef JOB_THREADS_MAX
+#  define JOB_THREADS_MAX 256
+#endif // JOB_THREADS_MAX
+
+static size_t job_thread_count = 0; // 0 until resolved
+
+static size_t job_default_threads(void)
+{
+    const char *env = getenv("MEDO_THREADS");
+    long n = (env != NULL) ? atol(env) : 0;
+    if (n <= 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n <= 0) n = 1;
+    return ((size_t) n < JOB_THREADS_MAX) ? (size_t) n : JOB_THREADS_MAX;
+}
+
+size_t job_threads(void)
+{
+    if (job_thread_count == 0) job_thread_count = job_default_threads();
+    return job_thread_count;
+}
+
+void job_set_threads(size_t n)
+{
+    if (n > JOB_THREADS_MAX) n = JOB_THREADS_MAX;
+    job_thread_count = (n > 0) ? n : job_default_threads();
+}
+
+typedef struct {
+    Job_Fn fn;
+    void *ctx;
+    size_t count;
+    atomic_size_t next;
+} Job_Batch;
+
+static void *job_worker(void *arg)
+{
+    Job_Batch *batch = arg;
+    for (;;) {
+        size_t i = atomic_fetch_add(&batch->next, 1);
+        if (i >= batch->count) break;
+        batch->fn(batch->ctx, i);
+    }
+    return NULL;
+}
+
+void job_parallel_for(size_t count, Job_Fn fn, void *ctx)
+{
+    size_t threads = job_threads();
+    if (threads > count) threads = count;
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i++) fn(ctx, i);
+        return;
+    }
+
+    Job_Batch batch = { .fn = fn, .ctx = ctx, .count = count };
+    atomic_init(&batch.next, 0);
+
+    pthread_t workers[JOB_THREADS_MAX];
+    size_t spawned = 0;
+    for (; spawned + 1 < threads; spawned++) {
+        if (pthread_create(&workers[spawned], NULL, job_worker, &batch) != 0) break;
+    }
+    job_worker(&batch);
+    for (size_t i = 0; i < spawned; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+// Background jobs
+
+struct Job {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    atomic_bool cancelled;
+    atomic_bool done;
+    Job_Task task;
+    void *ctx;
+};
+
+static void *job_run(void *arg)
+{
+    Job *job = arg;
+    job->task(job, job->ctx);
+    atomic_store(&job->done, true);
+    return NULL;
+}
+
+Job *job_start(Job_Task task, void *ctx)
+{
+    Job *job = malloc(sizeof(*job));
+    assert(job != NULL);
+    job->task = task;
+    job->ctx = ctx;
+    atomic_init(&job->cancelled, false);
+    atomic_init(&job->done, false);
+    pthread_mutex_init(&job->lock, NULL);
+    if (pthread_create(&job->thread, NULL, job_run, job) != 0) {
+        job_run(job); // no thread to spare, do it right away
+        job->thread = pthread_self();
+    }
+    return job;
+}
+
+bool job_cancelled(Job *job)
+{
+    return atomic_load_explicit(&job->cancelled, memory_order_relaxed);
+}
+
+bool job_done(Job *job)
+{
+    return atomic_load(&job->done);
+}
+
+void job_lock(Job *job)
+{
+    pthread_mutex_lock(&job->lock);
+}
+
+void job_unlock(Job *job)
+{
+    pthread_mutex_unlock(&job->lock);
+}
+
+void job_wait(Job *job)
+{
+    if (!pthread_equal(job->thread, pthread_self())) pthread_join(job->thread, NULL);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
+
+void job_cancel(Job *job)
+{
+    atomic_store(&job->cancelled, true);
+    job_wait(job);
+}
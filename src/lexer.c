@@ -1,6 +1,7 @@
 #define _DEFAULT_SOURCE
 
 #include "lexer.h"
+#include "scan.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -13,11 +14,11 @@
         l->cur += n; \
     } while (0) 
 
-#define lchar l->s[l->cur]
+#define lchar ((unsigned char) lexer_char(l, l->cur))
 
 static bool ishex(char c)
 {
-    return (c >= '0' && c <= '9') || (tolower(c) >= 'a' && tolower(c) <= 'f');
+    return (c >= '0' && c <= '9') || (tolower((unsigned char) c) >= 'a' && tolower((unsigned char) c) <= 'f');
 }
 
 static bool isbin(char c)
@@ -40,14 +41,40 @@ Lexer lexer_init(const char *s, size_t len, const char **keywords)
 {
     Lexer l = {0};
     l.s = s;
+    l.s_len = len;
     l.len = len;
     l.keywords = keywords;
     return l;
 }
 
+Lexer lexer_init_spans(const void *src, Lexer_Span span, size_t len, const char **keywords)
+{
+    Lexer l = {0};
+    l.span = span;
+    l.src = src;
+    l.len = len;
+    l.keywords = keywords;
+    return l;
+}
+
+static char lexer_char(Lexer *l, size_t at)
+{
+    if (at >= l->len) return '\0';
+    if (at < l->s_home || at >= l->s_home + l->s_len) {
+        assert(l->span != NULL);
+        l->s = l->span(l->src, at, &l->s_len);
+        l->s_home = at;
+    }
+    return l->s[at - l->s_home];
+}
+
 static bool lexer_strneq(Lexer *l, const char *s, size_t n)
 {
-    return (l->cur + n <= l->len && strncmp(&lchar, s, n) == 0);
+    if (l->cur + n > l->len) return false;
+    for (size_t i = 0; i < n; i++) {
+        if (lexer_char(l, l->cur + i) != s[i]) return false;
+    }
+    return true;
 }
 #define lexer_streq(l, s) lexer_strneq(l, s, strlen(s))
 
@@ -56,14 +83,33 @@ static bool lexer_char_in_str(Lexer *l, const char *s)
     return (l->cur < l->len && *strchrnul(s, lchar) != '\0');
 }
 
+// Symbols are made of word bytes, which take bytes of multibyte UTF-8
+// characters as letters
 static bool is_symbol_start(char c)
 {
-    return isalpha(c) || c == '_';
+    return scan_class(c) == SCAN_CLASS_WORD && !(c >= '0' && c <= '9');
 }
 
 static bool is_symbol(char c)
 {
-    return isalnum(c) || c == '_';
+    return scan_class(c) == SCAN_CLASS_WORD;
+}
+
+// Moves the cursor past the bytes of the classes in `set`, a span at a time,
+// and returns how many there were
+static size_t lexer_skip_class(Lexer *l, unsigned set)
+{
+    size_t from = l->cur;
+    while (l->cur < l->len) {
+        lexer_char(l, l->cur); // fetches the span at the cursor
+        size_t off = l->cur - l->s_home;
+        size_t n = l->s_len - off;
+        if (n > l->len - l->cur) n = l->len - l->cur;
+        size_t run = scan_class_run(l->s + off, n, set);
+        l->cur += run;
+        if (run < n) break;
+    }
+    return l->cur - from;
 }
 
 Token lexer_next(Lexer *l)
@@ -78,7 +124,7 @@ Token lexer_next(Lexer *l)
             consume(1);
 
             if (lchar == '\n' && 
-                l->s[l->cur - 1] != '\\')
+                lexer_char(l, l->cur - 1) != '\\')
             {
                 consume(1);
                 break;
@@ -93,7 +139,7 @@ Token lexer_next(Lexer *l)
         while (l->cur < l->len) {
             consume(1);
             if (lchar == '\n' && 
-                l->s[l->cur - 1] != '\\') break;
+                lexer_char(l, l->cur - 1) != '\\') break;
         }
         return token;
     }
@@ -111,11 +157,9 @@ Token lexer_next(Lexer *l)
         return token;
     }
 
-    if (isspace(lchar)) {
+    if (scan_class(lchar) == SCAN_CLASS_SPACE) {
         token.kind = TOKEN_WHITESPACE;
-        while (isspace(lchar)) {
-            consume(1);
-        }
+        token.len = lexer_skip_class(l, SCAN_CLASS_BIT(SCAN_CLASS_SPACE));
         return token;
     }
 
@@ -124,7 +168,7 @@ Token lexer_next(Lexer *l)
 
         while (l->cur < l->len) {
             consume(1);
-            if (lchar == '\"' && l->s[l->cur - 1] != '\\') {
+            if (lchar == '\"' && lexer_char(l, l->cur - 1) != '\\') {
                 consume(1);
                 break;
             }
@@ -137,7 +181,7 @@ Token lexer_next(Lexer *l)
 
         while (l->cur < l->len && lchar != '\n') {
             consume(1);
-            if (lchar == '\'' && l->s[l->cur - 1] != '\\') {
+            if (lchar == '\'' && lexer_char(l, l->cur - 1) != '\\') {
                 consume(1);
                 break;
             }
@@ -150,7 +194,7 @@ Token lexer_next(Lexer *l)
             for (size_t i = 0; l->keywords[i] != NULL; i++) {
                 if (lexer_streq(l, l->keywords[i])) {
                     size_t klen = strlen(l->keywords[i]);
-                    if (l->cur + klen > l->len || is_symbol(l->s[l->cur + klen])) break;
+                    if (l->cur + klen > l->len || is_symbol(lexer_char(l, l->cur + klen))) break;
                     token.kind = TOKEN_KEYWORD;
                     token.len = klen;
                     l->cur += klen;
@@ -159,9 +203,7 @@ Token lexer_next(Lexer *l)
             }
         }
         token.kind = TOKEN_SYMBOL;
-        while (l->cur < l->len && is_symbol(lchar)) {
-            consume(1);
-        }
+        token.len = lexer_skip_class(l, SCAN_CLASS_BIT(SCAN_CLASS_WORD));
         return token;
     }
 
@@ -170,7 +212,7 @@ Token lexer_next(Lexer *l)
         bool has_dot = lchar == '.';
 
         if (lchar == '0') {
-            if (l->cur + 1 < l->len && tolower(l->s[l->cur + 1]) == 'x') {
+            if (l->cur + 1 < l->len && tolower(lexer_char(l, l->cur + 1)) == 'x') {
                 consume(2);
                 
                 if (l->cur >= l->len || !ishex(lchar)) {
@@ -185,7 +227,7 @@ Token lexer_next(Lexer *l)
                 }
                 return token;
 
-            } else if (l->cur + 1 < l->len && tolower(l->s[l->cur + 1]) == 'b') {
+            } else if (l->cur + 1 < l->len && tolower(lexer_char(l, l->cur + 1)) == 'b') {
                 consume(2);
 
                 if (l->cur >= l->len || !isbin(lchar)) {
@@ -0,0 +1,650 @@
+#include "scan.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define SCAN_X86
+#  include <immintrin.h>
+#endif // __GNUC__ && x86
+
+static_assert(COUNT_SCAN_ISAS == 3, "Scan_Isa enum has changed");
+static_assert(COUNT_SCAN_CLASSES == 3, "Scan_Class enum has changed");
+
+#define O SCAN_CLASS_OTHER
+#define S SCAN_CLASS_SPACE
+#define W SCAN_CLASS_WORD
+
+const unsigned char scan_classes[256] = {
+    O, O, O, O, O, O, O, O, O, S, S, S, S, S, O, O, // 0x00, \t \n \v \f \r
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0x10
+    S, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0x20, ' '
+    W, W, W, W, W, W, W, W, W, W, O, O, O, O, O, O, // 0x30, 0-9
+    O, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, // 0x40, A-O
+    W, W, W, W, W, W, W, W, W, W, W, O, O, O, O, W, // 0x50, P-Z _
+    O, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, // 0x60, a-o
+    W, W, W, W, W, W, W, W, W, W, W, O, O, O, O, O, // 0x70, p-z
+    W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, // 0x80, UTF-8 from here on
+    W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+    W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+    W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+    W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+    W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+    W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+    W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+};
+
+#undef O
+#undef S
+#undef W
+
+// Scalar
+
+static size_t scan_newlines_scalar(const char *s, size_t n, size_t base, size_t *out)
+{
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\n') out[k++] = base + i;
+    }
+    return k;
+}
+
+static size_t scan_count_newlines_scalar(const char *s, size_t n)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\n') count++;
+    }
+    return count;
+}
+
+static size_t scan_count_blank_lines_scalar(const char *s, size_t n, char prev)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\n' && prev == '\n') count++;
+        prev = s[i];
+    }
+    return count;
+}
+
+static size_t scan_count_chars_scalar(const char *s, size_t n)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (((unsigned char) s[i] & 0xC0) != 0x80) count++;
+    }
+    return count;
+}
+
+// Length of the valid UTF-8 character at u[0], 0 if it is invalid or cut off
+static size_t scan_utf8_char(const unsigned char *u, size_t n)
+{
+    if (u[0] < 0x80) return 1;
+
+    // Bounds of the second byte rule out overlong forms, surrogates and
+    // code points past U+10FFFF
+    size_t len;
+    unsigned char lo = 0x80, hi = 0xBF;
+    if (u[0] >= 0xC2 && u[0] <= 0xDF) {
+        len = 2;
+    } else if (u[0] >= 0xE0 && u[0] <= 0xEF) {
+        len = 3;
+        if (u[0] == 0xE0) lo = 0xA0;
+        if (u[0] == 0xED) hi = 0x9F;
+    } else if (u[0] >= 0xF0 && u[0] <= 0xF4) {
+        len = 4;
+        if (u[0] == 0xF0) lo = 0x90;
+        if (u[0] == 0xF4) hi = 0x8F;
+    } else {
+        return 0;
+    }
+
+    if (n < len || u[1] < lo || u[1] > hi) return 0;
+    for (size_t i = 2; i < len; i++) {
+        if ((u[i] & 0xC0) != 0x80) return 0;
+    }
+    return len;
+}
+
+static size_t scan_utf8_valid_scalar(const char *s, size_t n)
+{
+    const unsigned char *u = (const unsigned char *) s;
+    size_t i = 0;
+    while (i < n) {
+        size_t len = scan_utf8_char(u + i, n - i);
+        if (len == 0) break;
+        i += len;
+    }
+    return i;
+}
+
+static size_t scan_class_run_scalar(const char *s, size_t n, unsigned set)
+{
+    size_t i = 0;
+    while (i < n && (set & SCAN_CLASS_BIT(scan_class(s[i])))) i++;
+    return i;
+}
+
+static size_t scan_class_run_back_scalar(const char *s, size_t n, unsigned set)
+{
+    size_t i = n;
+    while (i > 0 && (set & SCAN_CLASS_BIT(scan_class(s[i - 1])))) i--;
+    return n - i;
+}
+
+// Start of the character that u[i] is part of, given that the text before
+// it is valid. The vector kernels resume from there with the scalar one.
+static size_t scan_utf8_resume(const unsigned char *u, size_t i)
+{
+    size_t p = i;
+    while (p > 0 && i - p < 3 && (u[p - 1] & 0xC0) == 0x80) p--;
+    if (p > 0 && u[p - 1] >= 0xC0) {
+        size_t len = (u[p - 1] >= 0xF0) ? 4 : (u[p - 1] >= 0xE0) ? 3 : 2;
+        if (p - 1 + len > i) return p - 1;
+    }
+    return i;
+}
+
+#ifdef SCAN_X86
+
+// Compare a block against '\n', turn the result into a bit mask and emit one
+// offset per set bit, lowest first
+
+__attribute__((target("sse2")))
+static size_t scan_newlines_sse2(const char *s, size_t n, size_t base, size_t *out)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t k = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        while (mask != 0) {
+            out[k++] = base + i + (size_t) __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return k + scan_newlines_scalar(s + i, n - i, base + i, out + k);
+}
+
+// Matches are accumulated as bytewise counters and folded with a SAD before
+// they can overflow
+__attribute__((target("sse2")))
+static size_t scan_count_newlines_sse2(const char *s, size_t n)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    size_t i = 0;
+    while (i + 16 <= n) {
+        __m128i acc = zero;
+        for (size_t j = 0; j < 255 && i + 16 <= n; j++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, total);
+    return (size_t) (lanes[0] + lanes[1]) + scan_count_newlines_scalar(s + i, n - i);
+}
+
+// A newline ends a blank line when the bit before its own is set too, which
+// for the first one is carried over from the block before
+__attribute__((target("sse2")))
+static size_t scan_count_blank_lines_sse2(const char *s, size_t n, char prev)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    uint32_t carry = (prev == '\n');
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        count += (size_t) __builtin_popcount(mask & ((mask << 1) | carry));
+        carry = mask >> 15;
+    }
+    return count + scan_count_blank_lines_scalar(s + i, n - i, (i > 0) ? s[i - 1] : prev);
+}
+
+// Continuation bytes are 0x80..0xBF, which are the signed bytes below -64
+__attribute__((target("sse2")))
+static size_t scan_count_chars_sse2(const char *s, size_t n)
+{
+    const __m128i cont = _mm_set1_epi8(-64);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    size_t i = 0;
+    while (i + 16 <= n) {
+        __m128i acc = zero;
+        for (size_t j = 0; j < 255 && i + 16 <= n; j++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(cont, v));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, total);
+    return i - (size_t) (lanes[0] + lanes[1]) + scan_count_chars_scalar(s + i, n - i);
+}
+
+// Skips over ASCII a block at a time and checks the rest character by character
+__attribute__((target("sse2")))
+static size_t scan_utf8_valid_sse2(const char *s, size_t n)
+{
+    const unsigned char *u = (const unsigned char *) s;
+    size_t i = 0;
+    while (i + 16 <= n) {
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (s + i)));
+        if (mask == 0) {
+            i += 16;
+            continue;
+        }
+        size_t end = i + 16;
+        i += (size_t) __builtin_ctz(mask);
+        while (i < end) {
+            size_t len = scan_utf8_char(u + i, n - i);
+            if (len == 0) return i;
+            i += len;
+        }
+    }
+    return i + scan_utf8_valid_scalar(s + i, n - i);
+}
+
+// Classes are told apart by range compares, an unsigned x <= k being
+// min(x, k) == x. Bytes from 0x80 on are the negative ones. `sets` holds a
+// mask of all ones for every class in the set, and of none for the others.
+__attribute__((target("sse2")))
+static inline __m128i scan_class_in_sse2(__m128i v, const __m128i *sets)
+{
+    __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i alpha = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i ctrl = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i word = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit),
+                     _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(25)), alpha)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+                     _mm_cmplt_epi8(v, _mm_setzero_si128())));
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                 _mm_cmpeq_epi8(_mm_min_epu8(ctrl, _mm_set1_epi8(4)), ctrl));
+    return _mm_or_si128(_mm_or_si128(_mm_and_si128(word, sets[SCAN_CLASS_WORD]), _mm_and_si128(space, sets[SCAN_CLASS_SPACE])),
+                        _mm_andnot_si128(_mm_or_si128(word, space), sets[SCAN_CLASS_OTHER]));
+}
+
+__attribute__((target("sse2")))
+static size_t scan_class_run_sse2(const char *s, size_t n, unsigned set)
+{
+    __m128i sets[COUNT_SCAN_CLASSES];
+    for (size_t c = 0; c < COUNT_SCAN_CLASSES; c++) {
+        sets[c] = (set & SCAN_CLASS_BIT(c)) ? _mm_set1_epi8(-1) : _mm_setzero_si128();
+    }
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        uint32_t out = ~(uint32_t) _mm_movemask_epi8(scan_class_in_sse2(v, sets)) & 0xFFFF;
+        if (out != 0) return i + (size_t) __builtin_ctz(out);
+    }
+    return i + scan_class_run_scalar(s + i, n - i, set);
+}
+
+__attribute__((target("sse2")))
+static size_t scan_class_run_back_sse2(const char *s, size_t n, unsigned set)
+{
+    __m128i sets[COUNT_SCAN_CLASSES];
+    for (size_t c = 0; c < COUNT_SCAN_CLASSES; c++) {
+        sets[c] = (set & SCAN_CLASS_BIT(c)) ? _mm_set1_epi8(-1) : _mm_setzero_si128();
+    }
+    size_t i = n;
+    for (; i >= 16; i -= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i - 16));
+        uint32_t out = ~(uint32_t) _mm_movemask_epi8(scan_class_in_sse2(v, sets)) & 0xFFFF;
+        if (out != 0) return n - i + (size_t) __builtin_clz(out << 16);
+    }
+    return n - i + scan_class_run_back_scalar(s, i, set);
+}
+
+__attribute__((target("avx2,bmi,popcnt")))
+static size_t scan_newlines_avx2(const char *s, size_t n, size_t base, size_t *out)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t k = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *) (s + i + 32));
+        uint64_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl))
+            | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32;
+        while (mask != 0) {
+            out[k++] = base + i + (size_t) _tzcnt_u64(mask);
+            mask = _blsr_u64(mask);
+        }
+    }
+    return k + scan_newlines_scalar(s + i, n - i, base + i, out + k);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t scan_count_newlines_avx2(const char *s, size_t n)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *) (s + i + 32));
+        uint64_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl))
+            | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32;
+        count += (size_t) _mm_popcnt_u64(mask);
+    }
+    return count + scan_count_newlines_scalar(s + i, n - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t scan_count_blank_lines_avx2(const char *s, size_t n, char prev)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    uint64_t carry = (prev == '\n');
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *) (s + i + 32));
+        uint64_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl))
+            | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32;
+        count += (size_t) _mm_popcnt_u64(mask & ((mask << 1) | carry));
+        carry = mask >> 63;
+    }
+    return count + scan_count_blank_lines_scalar(s + i, n - i, (i > 0) ? s[i - 1] : prev);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t scan_count_chars_avx2(const char *s, size_t n)
+{
+    const __m256i cont = _mm256_set1_epi8(-64);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *) (s + i + 32));
+        uint64_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpgt_epi8(cont, lo))
+            | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpgt_epi8(cont, hi)) << 32;
+        count += 64 - (size_t) _mm_popcnt_u64(mask);
+    }
+    return count + scan_count_chars_scalar(s + i, n - i);
+}
+
+// Validation by table lookups (Keiser and Lemire, "Validating UTF-8 in less
+// than one instruction per byte"). Every byte is looked up by the high and
+// low nibble of the byte before it and by its own high nibble, each lookup
+// giving the errors the pair could be part of; a pair is wrong when all three
+// agree on one. What is left are the third and fourth bytes of long
+// characters, which must be continuation bytes exactly where expected.
+
+enum {
+    UTF8_TOO_SHORT      = 1 << 0, // lead byte not followed by a continuation byte
+    UTF8_TOO_LONG       = 1 << 1, // continuation byte after ASCII
+    UTF8_OVERLONG_3     = 1 << 2,
+    UTF8_TOO_LARGE      = 1 << 3,
+    UTF8_SURROGATE      = 1 << 4,
+    UTF8_OVERLONG_2     = 1 << 5,
+    UTF8_TOO_LARGE_1000 = 1 << 6,
+    UTF8_OVERLONG_4     = 1 << 6,
+    UTF8_TWO_CONTS      = 1 << 7, // continuation byte after a continuation byte
+    UTF8_CARRY          = UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS,
+};
+
+static const uint8_t scan_utf8_byte_1_high[16] = {
+    // 0_______ ASCII
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    // 10______ continuation
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    // 1100____ and 1101____ two byte lead
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    // 1110____ three byte lead
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    // 1111____ four byte lead
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+static const uint8_t scan_utf8_byte_1_low[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4, // ____0000
+    UTF8_CARRY | UTF8_OVERLONG_2,                                     // ____0001
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,                                      // ____0100
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE, // ____1101
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+static const uint8_t scan_utf8_byte_2_high[16] = {
+    // 0_______ ASCII
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    // 1000____
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    // 1001____
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+    // 101_____
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    // 11______ lead
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+__attribute__((target("avx2")))
+static __m256i scan_lookup16_avx2(const uint8_t *table, __m256i nibbles)
+{
+    __m256i t = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) table));
+    return _mm256_shuffle_epi8(t, nibbles);
+}
+
+// Stops at the first block with an error and leaves finding it, as well as
+// the tail, to the scalar kernel
+__attribute__((target("avx2")))
+static size_t scan_utf8_valid_avx2(const char *s, size_t n)
+{
+    const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+    const __m256i third_byte = _mm256_set1_epi8(0xE0 - 0x80);  // only 111_____ stay >= 0x80
+    const __m256i fourth_byte = _mm256_set1_epi8(0xF0 - 0x80); // only 1111____ stay >= 0x80
+    const __m256i high_bit = _mm256_set1_epi8((char) 0x80);
+
+    __m256i prev = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i carried = _mm256_permute2x128_si256(prev, input, 0x21);
+        __m256i prev1 = _mm256_alignr_epi8(input, carried, 15);
+        __m256i prev2 = _mm256_alignr_epi8(input, carried, 14);
+        __m256i prev3 = _mm256_alignr_epi8(input, carried, 13);
+
+        __m256i special = _mm256_and_si256(
+            _mm256_and_si256(
+                scan_lookup16_avx2(scan_utf8_byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble)),
+                scan_lookup16_avx2(scan_utf8_byte_1_low, _mm256_and_si256(prev1, low_nibble))),
+            scan_lookup16_avx2(scan_utf8_byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble)));
+        __m256i must_continue = _mm256_or_si256(
+            _mm256_subs_epu8(prev2, third_byte),
+            _mm256_subs_epu8(prev3, fourth_byte));
+        __m256i error = _mm256_xor_si256(_mm256_and_si256(must_continue, high_bit), special);
+        if (!_mm256_testz_si256(error, error)) break;
+        prev = input;
+    }
+
+    size_t j = scan_utf8_resume((const unsigned char *) s, i);
+    return j + scan_utf8_valid_scalar(s + j, n - j);
+}
+
+__attribute__((target("avx2,bmi")))
+static inline __m256i scan_class_in_avx2(__m256i v, const __m256i *sets)
+{
+    __m256i digit = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i ctrl = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i word = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit),
+                        _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(25)), alpha)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')),
+                        _mm256_cmpgt_epi8(_mm256_setzero_si256(), v)));
+    __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                    _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, _mm256_set1_epi8(4)), ctrl));
+    return _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(word, sets[SCAN_CLASS_WORD]), _mm256_and_si256(space, sets[SCAN_CLASS_SPACE])),
+                        _mm256_andnot_si256(_mm256_or_si256(word, space), sets[SCAN_CLASS_OTHER]));
+}
+
+__attribute__((target("avx2,bmi")))
+static size_t scan_class_run_avx2(const char *s, size_t n, unsigned set)
+{
+    __m256i sets[COUNT_SCAN_CLASSES];
+    for (size_t c = 0; c < COUNT_SCAN_CLASSES; c++) {
+        sets[c] = (set & SCAN_CLASS_BIT(c)) ? _mm256_set1_epi8(-1) : _mm256_setzero_si256();
+    }
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        uint32_t out = ~(uint32_t) _mm256_movemask_epi8(scan_class_in_avx2(v, sets));
+        if (out != 0) return i + (size_t) _tzcnt_u32(out);
+    }
+    return i + scan_class_run_scalar(s + i, n - i, set);
+}
+
+__attribute__((target("avx2,bmi")))
+static size_t scan_class_run_back_avx2(const char *s, size_t n, unsigned set)
+{
+    __m256i sets[COUNT_SCAN_CLASSES];
+    for (size_t c = 0; c < COUNT_SCAN_CLASSES; c++) {
+        sets[c] = (set & SCAN_CLASS_BIT(c)) ? _mm256_set1_epi8(-1) : _mm256_setzero_si256();
+    }
+    size_t i = n;
+    for (; i >= 32; i -= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i - 32));
+        uint32_t out = ~(uint32_t) _mm256_movemask_epi8(scan_class_in_avx2(v, sets));
+        if (out != 0) return n - i + (size_t) __builtin_clz(out);
+    }
+    return n - i + scan_class_run_back_scalar(s, i, set);
+}
+
+#endif // SCAN_X86
+
+// Dispatch
+
+typedef struct {
+    size_t (*newlines)(const char *s, size_t n, size_t base, size_t *out);
+    size_t (*count_newlines)(const char *s, size_t n);
+    size_t (*count_blank_lines)(const char *s, size_t n, char prev);
+    size_t (*count_chars)(const char *s, size_t n);
+    size_t (*utf8_valid)(const char *s, size_t n);
+    size_t (*class_run)(const char *s, size_t n, unsigned set);
+    size_t (*class_run_back)(const char *s, size_t n, unsigned set);
+} Scan_Kernels;
+
+static const Scan_Kernels scan_kernels[COUNT_SCAN_ISAS] = {
+    [SCAN_ISA_SCALAR] = {
+        scan_newlines_scalar, scan_count_newlines_scalar,
+        scan_count_blank_lines_scalar,
+        scan_count_chars_scalar, scan_utf8_valid_scalar,
+        scan_class_run_scalar, scan_class_run_back_scalar,
+    },
+#ifdef SCAN_X86
+    [SCAN_ISA_SSE2] = {
+        scan_newlines_sse2, scan_count_newlines_sse2,
+        scan_count_blank_lines_sse2,
+        scan_count_chars_sse2, scan_utf8_valid_sse2,
+        scan_class_run_sse2, scan_class_run_back_sse2,
+    },
+    [SCAN_ISA_AVX2] = {
+        scan_newlines_avx2, scan_count_newlines_avx2,
+        scan_count_blank_lines_avx2,
+        scan_count_chars_avx2, scan_utf8_valid_avx2,
+        scan_class_run_avx2, scan_class_run_back_avx2,
+    },
+#endif // SCAN_X86
+};
+
+static Scan_Isa scan_detect(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi")
+        && __builtin_cpu_supports("popcnt")) return SCAN_ISA_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SCAN_ISA_SSE2;
+#endif // SCAN_X86
+    return SCAN_ISA_SCALAR;
+}
+
+// Atomic because the kernels are called from worker threads as well
+static atomic_int scan_active = COUNT_SCAN_ISAS; // not detected yet
+
+Scan_Isa scan_isa(void)
+{
+    int isa = atomic_load_explicit(&scan_active, memory_order_relaxed);
+    if (isa == COUNT_SCAN_ISAS) {
+        isa = scan_detect();
+        atomic_store_explicit(&scan_active, isa, memory_order_relaxed);
+    }
+    return isa;
+}
+
+void scan_set_isa(Scan_Isa isa)
+{
+    Scan_Isa best = scan_detect();
+    atomic_store_explicit(&scan_active, (isa < best) ? isa : best, memory_order_relaxed);
+}
+
+const char *scan_isa_name(Scan_Isa isa)
+{
+    switch (isa) {
+        case SCAN_ISA_SCALAR: return "scalar";
+        case SCAN_ISA_SSE2:   return "sse2";
+        case SCAN_ISA_AVX2:   return "avx2";
+        default:
+            assert(0 && "unreachable");
+    }
+    return NULL;
+}
+
+size_t scan_newlines(const char *s, size_t n, size_t base, size_t *out)
+{
+    return scan_kernels[scan_isa()].newlines(s, n, base, out);
+}
+
+size_t scan_count_newlines(const char *s, size_t n)
+{
+    return scan_kernels[scan_isa()].count_newlines(s, n);
+}
+
+size_t scan_count_blank_lines(const char *s, size_t n, char prev)
+{
+    return scan_kernels[scan_isa()].count_blank_lines(s, n, prev);
+}
+
+size_t scan_count_chars(const char *s, size_t n)
+{
+    return scan_kernels[scan_isa()].count_chars(s, n);
+}
+
+size_t scan_utf8_valid(const char *s, size_t n)
+{
+    return scan_kernels[scan_isa()].utf8_valid(s, n);
+}
+
+size_t scan_class_run(const char *s, size_t n, unsigned set)
+{
+    return scan_kernels[scan_isa()].class_run(s, n, set);
+}
+
+size_t scan_class_run_back(const char *s, size_t n, unsigned set)
+{
+    return scan_kernels[scan_isa()].class_run_back(s, n, set);
+}